@@ -0,0 +1,134 @@
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <assert.h>
+
+#include "sa.h"
+
+/*
+ * block-sorting stages: BWT over the circular suffix array, then
+ * move-to-front and run-length coding, each with its inverse
+ */
+
+int bwt_forward(const unsigned char *str, int len, unsigned char *out)
+{
+	int primary = 0;
+	int *csa = csa_sort(str, len);
+
+	// last column of the sorted rotations
+	for (int i = 0; i < len; i++) {
+		int j = csa[i];
+		if (j == 0) {
+			primary = i;
+			j = len;
+		}
+		out[i] = str[j - 1];
+	}
+
+	free(csa);
+
+	return primary;
+}
+
+void bwt_inverse(const unsigned char *bwt, int len, int primary, unsigned char *out)
+{
+	int count[R+1] = { 0 };
+	// row of the next rotation with its first character in the low byte,
+	// one random access per output byte instead of two
+	uint64_t *next = malloc(len * sizeof(uint64_t));
+	assert(next);
+
+	for (int i = 0; i < len; i++)
+		count[bwt[i]+1]++;
+	for (int i = 0; i < R; i++)
+		count[i+1] += count[i];
+	for (int i = 0; i < len; i++)
+		next[count[bwt[i]]++] = (uint64_t)i << 8 | bwt[i];
+
+	uint64_t e = (uint64_t)primary << 8;
+	for (int i = 0; i < len; i++) {
+		e = next[e >> 8];
+		out[i] = e & 0xff;
+	}
+
+	free(next);
+}
+
+void mtf_encode(unsigned char *buf, int len)
+{
+	unsigned char order[R];
+
+	for (int i = 0; i < R; i++)
+		order[i] = i;
+
+	for (int i = 0; i < len; i++) {
+		unsigned char c = buf[i];
+		int j = 0;
+		while (order[j] != c)
+			j++;
+		memmove(order + 1, order, j);
+		order[0] = c;
+		buf[i] = j;
+	}
+}
+
+void mtf_decode(unsigned char *buf, int len)
+{
+	unsigned char order[R];
+
+	for (int i = 0; i < R; i++)
+		order[i] = i;
+
+	for (int i = 0; i < len; i++) {
+		int j = buf[i];
+		unsigned char c = order[j];
+		memmove(order + 1, order, j);
+		order[0] = c;
+		buf[i] = c;
+	}
+}
+
+// two equal bytes are followed by a count of further repeats, 0..255
+int rle_encode(const unsigned char *in, int len, unsigned char *out)
+{
+	int n = 0;
+
+	for (int i = 0; i < len;) {
+		unsigned char c = in[i];
+		out[n++] = c;
+		if (i + 1 < len && in[i + 1] == c) {
+			int run = 2;
+			while (i + run < len && in[i + run] == c && run < 257)
+				run++;
+			out[n++] = c;
+			out[n++] = run - 2;
+			i += run;
+		} else {
+			i++;
+		}
+	}
+
+	return n;
+}
+
+int rle_decode(const unsigned char *in, int len, unsigned char *out, int cap)
+{
+	int n = 0;
+
+	for (int i = 0; i < len;) {
+		unsigned char c = in[i++];
+		int run = 1;
+		if (i < len && in[i] == c) {
+			if (i + 1 >= len)
+				return -1;
+			run = 2 + in[i + 1];
+			i += 2;
+		}
+		if (n + run > cap)
+			return -1;
+		memset(out + n, c, run);
+		n += run;
+	}
+
+	return n;
+}
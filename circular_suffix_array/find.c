@@ -0,0 +1,107 @@
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include "sa.h"
+
+/*
+ * binary search over a suffix array, Manber & Myers style: every
+ * suffix between the two bounds shares at least min(lcp with the low
+ * bound, lcp with the high bound) characters with the pattern, so the
+ * comparison at mid starts there instead of at 0
+ */
+
+// compare suffix s with p from h on, *h is left at the match length;
+// a suffix that has p as prefix compares equal
+static int compare(const unsigned char *str, int len, int s,
+		   const unsigned char *p, int plen, int *h)
+{
+	int i = *h;
+
+	while (i < plen && s + i < len && str[s + i] == p[i])
+		i++;
+	*h = i;
+	if (i == plen)
+		return 0;
+	if (s + i == len)
+		return -1;
+	return str[s + i] < p[i] ? -1 : 1;
+}
+
+// first row in [lo, hi) whose suffix is >= p (upper: > p)
+static int search(const unsigned char *str, int len, const int *sa,
+		  const unsigned char *p, int plen, int lo, int hi, int upper)
+{
+	int llcp = 0, rlcp = 0;
+
+	while (lo < hi) {
+		int mid = lo + (hi - lo) / 2;
+		int h = llcp < rlcp ? llcp : rlcp;
+		int c = compare(str, len, sa[mid], p, plen, &h);
+		if (c < 0 || (upper && c == 0)) {
+			lo = mid + 1;
+			llcp = h;
+		} else {
+			hi = mid;
+			rlcp = h;
+		}
+	}
+	return lo;
+}
+
+int sa_find(const unsigned char *str, int len, const int *sa,
+	    const unsigned char *p, int plen, int *lo, int *hi)
+{
+	*lo = search(str, len, sa, p, plen, 0, len, 0);
+	*hi = search(str, len, sa, p, plen, *lo, len, 1);
+	return *hi - *lo;
+}
+
+struct query {
+	const unsigned char *p;
+	int plen;
+	int idx;
+};
+
+static int query_cmp(const void *a, const void *b)
+{
+	const struct query *x = a, *y = b;
+	int n = x->plen < y->plen ? x->plen : y->plen;
+	int c = memcmp(x->p, y->p, n);
+
+	if (c != 0)
+		return c;
+	return x->plen - y->plen;
+}
+
+void sa_find_batch(const unsigned char *str, int len, const int *sa,
+		   const unsigned char **ps, const int *plens, int n,
+		   int *lo, int *hi)
+{
+	struct query *q = malloc(n * sizeof(struct query));
+	assert(q || n == 0);
+
+	for (int i = 0; i < n; i++) {
+		q[i].p = ps[i];
+		q[i].plen = plens[i];
+		q[i].idx = i;
+	}
+	qsort(q, n, sizeof(struct query), query_cmp);
+
+	// in sorted order the lower bounds never move left, and equal
+	// neighbours share their answer
+	int from = 0;
+	for (int i = 0; i < n; i++) {
+		int k = q[i].idx;
+		if (i > 0 && query_cmp(&q[i - 1], &q[i]) == 0) {
+			lo[k] = lo[q[i - 1].idx];
+			hi[k] = hi[q[i - 1].idx];
+			continue;
+		}
+		lo[k] = search(str, len, sa, q[i].p, q[i].plen, from, len, 0);
+		hi[k] = search(str, len, sa, q[i].p, q[i].plen, lo[k], len, 1);
+		from = lo[k];
+	}
+
+	free(q);
+}
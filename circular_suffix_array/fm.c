@@ -0,0 +1,482 @@
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <assert.h>
+
+#include "sa.h"
+
+/*
+ * FM-index over the BWT of str$ ($ below every byte):
+ *
+ * - the BWT sits in a Huffman-shaped wavelet tree: every byte takes
+ *   as many bits as its Huffman code, so the bitvectors hold about
+ *   n(H0 + 1) bits instead of 8n, plus a rank directory of one uint32
+ *   per 256 bits. rank_c and access cost one bitvector rank per code
+ *   bit, fewer for frequent bytes, and the BWT itself is never stored
+ * - the $ row holds a 0 byte in the tree, rank_0 corrects for it
+ * - locate walks LF until a row whose text position is a multiple of
+ *   the sample rate. Those rows are a sparse set, Elias-Fano coded in
+ *   about 2 + lg(sample) bits each, and their positions divided by the
+ *   sample rate are packed in lg(n / sample) bits each
+ *
+ * H0 only sees byte frequencies, so this is zero-order compressed;
+ * text that compresses far better under BWT + MTF + RLE than under
+ * plain Huffman still pays H0 here
+ */
+
+// a tree node that is a leaf holding byte c is stored as LEAF(c)
+#define LEAF(c) (-1 - (c))
+
+struct bitvec {
+	uint64_t *w;
+	uint32_t *blk;
+	int nw, nblk;
+};
+
+struct node {
+	struct bitvec bv;  // 1: the byte's code goes right here
+	int child[2];      // node index, or LEAF(c)
+};
+
+// n values of bits bits each, bits < 32
+struct packed {
+	uint64_t *w;
+	int n, bits;
+};
+
+// sorted rows, Elias-Fano: the low lbits of the k-th in low, the rest
+// in unary in high, where the rows sharing a high part h come as ones
+// just before its h-th zero
+struct sparse {
+	int m, lbits;
+	struct packed low;
+	uint64_t *high;
+	int nw;
+	uint32_t *zero;  // position of every 256th zero in high
+	int nzero;
+};
+
+struct fm_index {
+	int n;          // rows, len + 1
+	int dollar;     // row of the $ in the BWT
+	int sample;
+	int C[R+1];     // rows starting below c, the $ row included
+	int root;       // LEAF(c) if the BWT holds a single byte value
+	int nnode;
+	struct node node[R-1];
+	uint64_t code[R];  // Huffman code of c, first bit at the root
+	int depth[R];      // its length, -1 if c is not in the BWT
+	struct sparse mark;  // rows whose text position is a multiple of sample
+	struct packed ssa;   // those positions / sample, in row order
+};
+
+static void bv_init(struct bitvec *b, int n)
+{
+	b->nw = (n >> 6) + 1;
+	b->nblk = (n >> 8) + 1;
+	b->w = calloc(b->nw, sizeof(uint64_t));
+	b->blk = malloc(b->nblk * sizeof(uint32_t));
+	assert(b->w && b->blk);
+}
+
+static void bv_build(struct bitvec *b)
+{
+	uint32_t sum = 0;
+
+	for (int i = 0; i < b->nw; i++) {
+		if ((i & 3) == 0)
+			b->blk[i >> 2] = sum;
+		sum += __builtin_popcountll(b->w[i]);
+	}
+}
+
+static size_t bv_size(const struct bitvec *b)
+{
+	return b->nw * sizeof(uint64_t) + b->nblk * sizeof(uint32_t);
+}
+
+static void bv_free(struct bitvec *b)
+{
+	free(b->w);
+	free(b->blk);
+}
+
+static inline void bv_set(struct bitvec *b, int i)
+{
+	b->w[i >> 6] |= 1ULL << (i & 63);
+}
+
+static inline int bv_get(const struct bitvec *b, int i)
+{
+	return b->w[i >> 6] >> (i & 63) & 1;
+}
+
+// ones in [0, i)
+static inline int bv_rank1(const struct bitvec *b, int i)
+{
+	int r = b->blk[i >> 8];
+
+	for (int j = (i >> 8) << 2; j < i >> 6; j++)
+		r += __builtin_popcountll(b->w[j]);
+	if (i & 63)
+		r += __builtin_popcountll(b->w[i >> 6] << (64 - (i & 63)));
+	return r;
+}
+
+static void pk_init(struct packed *p, int n, int bits)
+{
+	p->n = n;
+	p->bits = bits;
+	// one spare word, so a read never needs a bounds check
+	p->w = calloc(((int64_t)n * bits >> 6) + 2, sizeof(uint64_t));
+	assert(p->w);
+}
+
+static size_t pk_size(const struct packed *p)
+{
+	return (((int64_t)p->n * p->bits >> 6) + 2) * sizeof(uint64_t);
+}
+
+static inline void pk_set(struct packed *p, int i, uint64_t v)
+{
+	int64_t pos = (int64_t)i * p->bits;
+	int off = pos & 63;
+
+	p->w[pos >> 6] |= v << off;
+	if (off + p->bits > 64)
+		p->w[(pos >> 6) + 1] |= v >> (64 - off);
+}
+
+static inline uint64_t pk_get(const struct packed *p, int i)
+{
+	int64_t pos = (int64_t)i * p->bits;
+	int off = pos & 63;
+	uint64_t v = p->w[pos >> 6] >> off;
+
+	if (off + p->bits > 64)
+		v |= p->w[(pos >> 6) + 1] << (64 - off);
+	return v & ((1ULL << p->bits) - 1);
+}
+
+// bits to hold any value up to max
+static int bit_width(int max)
+{
+	int bits = 0;
+
+	while (bits < 31 && max >> bits)
+		bits++;
+	return bits;
+}
+
+// rows[0, m) ascending, all below n
+static void sp_build(struct sparse *s, const int *rows, int m, int n)
+{
+	int lbits = 0;
+
+	// about lg(n / m) low bits leaves some 2 bits per row in high
+	while ((int64_t)m << (lbits + 1) <= n)
+		lbits++;
+	s->m = m;
+	s->lbits = lbits;
+	pk_init(&s->low, m, lbits);
+
+	int nhigh = ((n - 1) >> lbits) + 1;
+	int64_t nbits = (int64_t)m + nhigh;
+	s->nw = (nbits >> 6) + 1;
+	s->high = calloc(s->nw, sizeof(uint64_t));
+	s->nzero = (nhigh + 255) >> 8;
+	s->zero = malloc(s->nzero * sizeof(uint32_t));
+	assert(s->high && s->zero);
+
+	for (int k = 0; k < m; k++) {
+		int64_t pos = (int64_t)(rows[k] >> lbits) + k;
+		s->high[pos >> 6] |= 1ULL << (pos & 63);
+		pk_set(&s->low, k, rows[k] & ((1 << lbits) - 1));
+	}
+	for (int64_t pos = 0, z = 0; pos < nbits; pos++) {
+		if (s->high[pos >> 6] >> (pos & 63) & 1)
+			continue;
+		if ((z & 255) == 0)
+			s->zero[z >> 8] = pos;
+		z++;
+	}
+}
+
+static size_t sp_size(const struct sparse *s)
+{
+	return pk_size(&s->low) + s->nw * sizeof(uint64_t) + s->nzero * sizeof(uint32_t);
+}
+
+static void sp_free(struct sparse *s)
+{
+	free(s->low.w);
+	free(s->high);
+	free(s->zero);
+}
+
+// position of the j-th zero in high, from the sampled one before it
+static int sp_select0(const struct sparse *s, int j)
+{
+	int pos = s->zero[j >> 8], r = j & 255, w = pos >> 6;
+	// zeros as ones, from the sampled one on
+	uint64_t x = ~s->high[w] & (~0ULL << (pos & 63));
+
+	for (int k; r >= (k = __builtin_popcountll(x)); r -= k)
+		x = ~s->high[++w];
+	for (; r > 0; r--)
+		x &= x - 1;
+	return w * 64 + __builtin_ctzll(x);
+}
+
+// index of row among the set, -1 if it is not in it
+static int sp_find(const struct sparse *s, int row)
+{
+	int h = row >> s->lbits;
+	uint64_t lo = row & ((1 << s->lbits) - 1);
+	// first row of bucket h, right after the zero ending h - 1
+	int pos = h ? sp_select0(s, h - 1) + 1 : 0;
+
+	for (int k = pos - h; s->high[pos >> 6] >> (pos & 63) & 1; pos++, k++) {
+		uint64_t v = pk_get(&s->low, k);
+		if (v >= lo)
+			return v == lo ? k : -1;
+	}
+	return -1;
+}
+
+// position i in node v maps to this in its child on side bit
+static inline int down(const struct node *v, int i, int bit)
+{
+	int ones = bv_rank1(&v->bv, i);
+	return bit ? ones : i - ones;
+}
+
+// occurrences of c in BWT[0, i)
+static int rank_c(const struct fm_index *fm, int c, int i)
+{
+	int p = i, v = fm->root;
+
+	if (fm->depth[c] < 0)
+		return 0;
+	for (int d = fm->depth[c] - 1; d >= 0; d--) {
+		int bit = fm->code[c] >> d & 1;
+		p = down(&fm->node[v], p, bit);
+		v = fm->node[v].child[bit];
+	}
+	if (c == 0 && fm->dollar < i)
+		p--;
+	return p;
+}
+
+// LF mapping of row, reading the BWT byte on the way down
+static int lf(const struct fm_index *fm, int row)
+{
+	int p = row, v = fm->root;
+
+	while (v >= 0) {
+		const struct node *nd = &fm->node[v];
+		int bit = bv_get(&nd->bv, p);
+		p = down(nd, p, bit);
+		v = nd->child[bit];
+	}
+	int c = LEAF(v);
+	if (c == 0 && fm->dollar < row)
+		p--;
+	return fm->C[c] + p;
+}
+
+// Huffman tree over the byte counts of the BWT, merging the two
+// lightest of at most R roots at a time
+static void huffman(struct fm_index *fm, const int *freq)
+{
+	int64_t weight[R];
+	int root[R], nroot = 0;
+
+	for (int c = 0; c < R; c++) {
+		fm->depth[c] = -1;
+		if (freq[c] > 0) {
+			weight[nroot] = freq[c];
+			root[nroot++] = LEAF(c);
+		}
+	}
+
+	while (nroot > 1) {
+		int a = 0, b = 1;
+		if (weight[b] < weight[a])
+			a = 1, b = 0;
+		for (int i = 2; i < nroot; i++) {
+			if (weight[i] < weight[a]) {
+				b = a;
+				a = i;
+			} else if (weight[i] < weight[b]) {
+				b = i;
+			}
+		}
+
+		int v = fm->nnode++;
+		fm->node[v].child[0] = root[a];
+		fm->node[v].child[1] = root[b];
+		weight[a] += weight[b];
+		root[a] = v;
+		weight[b] = weight[--nroot];
+		root[b] = root[nroot];
+	}
+	fm->root = root[0];
+}
+
+// codes by walking down from the root, 0 to the left
+static void assign_codes(struct fm_index *fm, int v, uint64_t code, int depth)
+{
+	if (v < 0) {
+		fm->code[LEAF(v)] = code;
+		fm->depth[LEAF(v)] = depth;
+		return;
+	}
+	assert(depth < 64);
+	assign_codes(fm, fm->node[v].child[0], code << 1, depth + 1);
+	assign_codes(fm, fm->node[v].child[1], code << 1 | 1, depth + 1);
+}
+
+// bitvector of node v over its n bytes in a, then a stable split into
+// the children, a left behind as scratch; tmp holds n bytes
+static void build_node(struct fm_index *fm, int v, unsigned char *a,
+		       unsigned char *tmp, int n, int depth)
+{
+	if (v < 0)
+		return;
+
+	struct node *nd = &fm->node[v];
+	int z = 0, o = 0;
+
+	bv_init(&nd->bv, n);
+	for (int i = 0; i < n; i++) {
+		int c = a[i];
+		if (fm->code[c] >> (fm->depth[c] - 1 - depth) & 1)
+			bv_set(&nd->bv, i);
+		else
+			z++;
+	}
+	bv_build(&nd->bv);
+
+	for (int i = 0; i < n; i++) {
+		if (bv_get(&nd->bv, i))
+			tmp[z + o++] = a[i];
+		else
+			a[i - o] = a[i];
+	}
+	memcpy(a + z, tmp + z, o);
+
+	build_node(fm, nd->child[0], a, tmp, z, depth + 1);
+	build_node(fm, nd->child[1], a + z, tmp, o, depth + 1);
+}
+
+struct fm_index *fm_build(const unsigned char *str, int len, int sample)
+{
+	struct fm_index *fm = calloc(1, sizeof(*fm));
+	int *sa = sa_sais(str, len);
+	int n = len + 1, nsampled = 0;
+	unsigned char *cur = malloc(n), *tmp = malloc(n);
+	assert(fm && sa && cur && tmp);
+
+	fm->n = n;
+	fm->sample = sample > 0 ? sample : 64;
+
+	// BWT and sampled rows, row 0 is the suffix "$"
+	int *rows = malloc((len / fm->sample + 1) * sizeof(int));
+	assert(rows);
+	for (int r = 0; r < n; r++) {
+		int v = r == 0 ? len : sa[r - 1];
+		cur[r] = v ? str[v - 1] : 0;
+		if (v == 0)
+			fm->dollar = r;
+		if (v % fm->sample == 0)
+			rows[nsampled++] = r;
+	}
+	sp_build(&fm->mark, rows, nsampled, n);
+	pk_init(&fm->ssa, nsampled, bit_width(len / fm->sample));
+	for (int k = 0; k < nsampled; k++) {
+		int r = rows[k];
+		pk_set(&fm->ssa, k, (r == 0 ? len : sa[r - 1]) / fm->sample);
+	}
+	free(rows);
+	free(sa);
+
+	int count[R+1] = { 0 };
+	for (int i = 0; i < len; i++)
+		count[str[i]+1]++;
+	fm->C[0] = 1;
+	for (int c = 0; c < R; c++)
+		fm->C[c+1] = fm->C[c] + count[c+1];
+
+	// the BWT's bytes, its $ counted as a 0
+	int freq[R] = { 0 };
+	for (int i = 0; i < n; i++)
+		freq[cur[i]]++;
+	huffman(fm, freq);
+	assign_codes(fm, fm->root, 0, 0);
+	build_node(fm, fm->root, cur, tmp, n, 0);
+	free(cur);
+	free(tmp);
+
+	return fm;
+}
+
+void fm_free(struct fm_index *fm)
+{
+	for (int v = 0; v < fm->nnode; v++)
+		bv_free(&fm->node[v].bv);
+	sp_free(&fm->mark);
+	free(fm->ssa.w);
+	free(fm);
+}
+
+size_t fm_size(const struct fm_index *fm)
+{
+	size_t size = sizeof(*fm) + sp_size(&fm->mark) + pk_size(&fm->ssa);
+
+	for (int v = 0; v < fm->nnode; v++)
+		size += bv_size(&fm->node[v].bv);
+	return size;
+}
+
+// backward search, rows [*lo, *hi) hold the suffixes starting with p
+static void fm_range(const struct fm_index *fm, const unsigned char *p, int plen,
+		     int *lo, int *hi)
+{
+	// row 0 is the empty suffix "$", which only p's first step drops;
+	// the empty pattern matches the len real suffixes, as in sa_find()
+	int s = plen > 0 ? 0 : 1, e = fm->n;
+
+	for (int k = plen - 1; k >= 0 && s < e; k--) {
+		int c = p[k];
+		s = fm->C[c] + rank_c(fm, c, s);
+		e = fm->C[c] + rank_c(fm, c, e);
+	}
+	*lo = s;
+	*hi = s < e ? e : s;
+}
+
+int fm_count(const struct fm_index *fm, const unsigned char *p, int plen)
+{
+	int lo, hi;
+
+	fm_range(fm, p, plen, &lo, &hi);
+	return hi - lo;
+}
+
+int fm_locate(const struct fm_index *fm, const unsigned char *p, int plen,
+	      int *out, int max)
+{
+	int lo, hi;
+
+	fm_range(fm, p, plen, &lo, &hi);
+	for (int r = lo; r < hi && r - lo < max; r++) {
+		int row = r, steps = 0, k;
+		while ((k = sp_find(&fm->mark, row)) < 0) {
+			row = lf(fm, row);
+			steps++;
+		}
+		out[r - lo] = (int)pk_get(&fm->ssa, k) * fm->sample + steps;
+	}
+	return hi - lo;
+}
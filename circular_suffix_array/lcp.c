@@ -0,0 +1,99 @@
+#include <stdlib.h>
+#include <assert.h>
+
+#include "sa.h"
+
+/*
+ * LCP arrays from a finished suffix array, both linear time:
+ *
+ * - lcp_kasai walks suffixes in text order with an inverse SA, the
+ *   match length drops by at most one from i to i + 1
+ * - plcp_phi is the Phi variant of Karkkainen, Manzini & Puglisi: the
+ *   same walk, but over one array holding the SA predecessor of every
+ *   position, overwritten in place by its PLCP value
+ */
+
+int *lcp_kasai(const unsigned char *str, const int *sa, int len)
+{
+	int *rank = malloc(len * sizeof(int));
+	int *lcp = malloc(len * sizeof(int));
+	assert(rank && lcp);
+
+	for (int i = 0; i < len; i++)
+		rank[sa[i]] = i;
+
+	for (int i = 0, h = 0; i < len; i++) {
+		if (rank[i] == 0) {
+			lcp[0] = 0;
+			h = 0;
+			continue;
+		}
+		int j = sa[rank[i] - 1];
+		while (i + h < len && j + h < len && str[i + h] == str[j + h])
+			h++;
+		lcp[rank[i]] = h;
+		if (h > 0)
+			h--;
+	}
+
+	free(rank);
+
+	return lcp;
+}
+
+int *plcp_phi(const unsigned char *str, const int *sa, int len)
+{
+	int *plcp = malloc(len * sizeof(int));
+	assert(plcp);
+
+	if (len == 0)
+		return plcp;
+
+	// phi[sa[i]] = sa[i - 1], -1 for the smallest suffix
+	plcp[sa[0]] = -1;
+	for (int i = 1; i < len; i++)
+		plcp[sa[i]] = sa[i - 1];
+
+	// phi[i] is read before plcp[i] replaces it
+	for (int i = 0, h = 0; i < len; i++) {
+		int j = plcp[i];
+		if (j < 0) {
+			plcp[i] = 0;
+			h = 0;
+			continue;
+		}
+		while (i + h < len && j + h < len && str[i + h] == str[j + h])
+			h++;
+		plcp[i] = h;
+		if (h > 0)
+			h--;
+	}
+
+	return plcp;
+}
+
+int *lcp_from_plcp(const int *plcp, const int *sa, int len)
+{
+	int *lcp = malloc(len * sizeof(int));
+	assert(lcp);
+
+	for (int i = 0; i < len; i++)
+		lcp[i] = plcp[sa[i]];
+
+	return lcp;
+}
+
+int lcp_longest_repeat(const int *lcp, const int *sa, int len, int *pos)
+{
+	int best = 0;
+
+	*pos = -1;
+	for (int i = 1; i < len; i++) {
+		if (lcp[i] > best) {
+			best = lcp[i];
+			*pos = sa[i];
+		}
+	}
+
+	return best;
+}
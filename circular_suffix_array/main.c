@@ -5,100 +5,29 @@
 #include <errno.h>
 #include <assert.h>
 #include <time.h>
-
-#define R 256
-
-typedef int (*char_at_func_t)(const unsigned char *, int, int, int);
-
-static int sa_char_at(const unsigned char *str, int len, int suffix, int i)
-{
-	assert(suffix < len && i < len && suffix + i >= 0);
-	return suffix + i >= len ? -1 : str[suffix+i];
-}
-
-static int csa_char_at(const unsigned char *str, int len, int suffix, int i)
-{
-	assert(suffix < len && i < len && suffix + i >= 0);
-	return str[(suffix + i) % len];
-}
-
-// circular suffix array
-// using Radix sort + binary lifting
-// O(nlgn)
-int *csa_sort(const unsigned char *str, int len)
-{
-	int count_len = len > R ? len + 1 : R + 1;
-
-	int *csa = malloc(len * sizeof(int));
-	int *x = malloc(len * sizeof(int));
-	int *y = malloc(len * sizeof(int));
-	int *count = malloc(count_len * sizeof(int));
-	memset(count, 0, count_len * sizeof(int));
-	
-	for (int i = 0; i < len; i++) {
-		x[i] = str[i];
-		count[str[i] + 1]++;
-	}
-
-	for (int i = 0; i < R; i++) {
-		count[i+1] += count[i];
-	}
-
-	for (int i = 0; i < len; i++) {
-		csa[count[str[i]]] = i;
-		count[str[i]]++;
-	}
-
-	int r = R;
-	for (int k = 1; k < len; k *= 2) {
-		// each loop is an LSD sort with d = 2
-		//
-		// LSD sort d = 0
-		for (int i = 0; i < len; i++) {
-			y[i] = (csa[i] + len - k) % len;
-		}
-
-		memset(count, 0, (r+1)*sizeof(int));
-
-		// LSD sort d = 1
-		for (int i = 0; i < len; i++) {
-			count[x[y[i]] + 1]++;
-		}
-
-		for (int i = 0; i < r; i++) {
-			count[i+1] += count[i];
-		}
-
-		for (int i = 0; i < len; i++) {
-			csa[count[x[y[i]]]] = y[i];
-			count[x[y[i]]]++;
-		}
-
-		// swap(x, y)
-		memcpy(y, x, len * sizeof(int));
-
-		// construct new x[]
-		r = 0;
-		x[csa[0]] = 0;
-		for (int i = 1; i < len; i++) {
-			if (!(y[csa[i-1]] == y[csa[i]] && y[(csa[i-1]+k) % len] == y[(csa[i]+k) % len]))
-				r++;
-			x[csa[i]] = r;
-		}
-
-		assert(r < len);
-
-		if (r == len - 1) {
-			break;
-		}
-	}
-
-	free(count);
-	free(x);
-	free(y);
-
-	return csa;
-}
+#include <limits.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "sa.h"
+
+// 32-bit builders keep their plain names
+#define IDX int
+#define KEY uint64_t
+#define SFX(name) name
+#include "sa_impl.h"
+#undef IDX
+#undef KEY
+#undef SFX
+
+#define IDX int64_t
+#define KEY unsigned __int128
+#define SFX(name) name##64
+#include "sa_impl.h"
+#undef IDX
+#undef KEY
+#undef SFX
 
 // use LSD-sort to sort circular suffix array
 // O(n^2)
@@ -137,193 +66,511 @@ int *lsd_sort(const unsigned char *str, int len)
 	return sa;
 }
 
-static void exch(int *a, int x, int y)
-{
-	int tmp = a[x];
-	a[x] = a[y];
-	a[y] = tmp;
-}
-
-// [lo, hi)
-static void sort(const unsigned char *str, int len, int *sa, int lo, int hi, int d, char_at_func_t char_at)
+static char random_char()
 {
-	if (d >= len)
-		return;
-	if (hi <= lo + 1)
-		return;
-
-	int lt = lo, gt = hi - 1;
-	int v = char_at(str, len, sa[lo], d);
-	int i = lo + 1;
-
-	while (i <= gt) {
-		int t = char_at(str, len, sa[i], d);
-		if (t < v)
-			exch(sa, lt++, i++);
-		else if (t > v) {
-			exch(sa, i, gt--);
-		} else {
-			i++;
-		}
+	static int init = 0;
+	if (init == 0) {
+		init = 1;
+		srand(time(NULL));
 	}
 
-	sort(str, len, sa, lo, lt, d, char_at);
-	if (v >= 0)
-		sort(str, len, sa, lt, gt+1, d+1, char_at);
-	sort(str, len, sa, gt+1, hi, d, char_at);
+	return rand() % 256;
 }
 
-// sorting the suffix array or the circular suffix array
-// depends on char_at()
-int *__quick3way(const unsigned char *str, int len, char_at_func_t char_at)
+static unsigned char *generate_random_str(int len)
 {
-	int *sa = (int *)malloc(len * sizeof(int));
-	assert(sa);
-
+	char *str = malloc(len);
 	for (int i = 0; i < len; i++) {
-		sa[i] = i;
+		str[i] = random_char();
 	}
+	return str;
+}
 
-	sort(str, len, sa, 0, len, 0, char_at);
-
-	return sa;
+// words drawn from a small vocabulary, compresses like text does
+static unsigned char *generate_text(int len)
+{
+	static const char *words[] = {
+		"the", "suffix", "array", "of", "a", "string", "is", "sorted",
+		"rotation", "block", "and", "to", "in", "transform", "which",
+		"burrows", "wheeler", "compression", "front", "move",
+	};
+	int nwords = sizeof(words) / sizeof(words[0]);
+	unsigned char *str = malloc(len);
+
+	for (int i = 0; i < len;) {
+		const char *w = words[rand() % nwords];
+		while (*w && i < len)
+			str[i++] = *w++;
+		if (i < len)
+			str[i++] = rand() % 8 ? ' ' : '\n';
+	}
+	return str;
 }
 
-int *csa_quick3way(const unsigned char *str, int len)
+// Fibonacci word, about as repetitive as a string gets without a period
+static unsigned char *generate_fib(int len)
 {
-	return __quick3way(str, len, csa_char_at);
+	unsigned char *str = malloc(len);
+
+	// the n-th letter is b exactly when floor((n + 2) / phi) jumps
+	const double phi = 1.6180339887498949;
+	for (int i = 0; i < len; i++)
+		str[i] = (long)((i + 2) / phi) - (long)((i + 1) / phi) ? 'a' : 'b';
+	return str;
 }
 
-int *sa_quick3way(const unsigned char *str, int len)
+static double now_ms()
 {
-	return __quick3way(str, len, sa_char_at);
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
 }
 
-static int equal(const int *y, int len, int a, int b, int k)
+// time sa_sort against sa_sais (32 and 64-bit) on 1MB, 4MB, ... max_mb
+static void bench(int max_mb, unsigned char *(*generate)(int))
 {
-	if (a + k < len && b + k >= len) {
-		return 0;
-	}
+	printf("%8s %12s %12s %12s\n", "MB", "sa_sort ms", "sa_sais ms", "sais64 ms");
 
-	if (a + k >= len && b + k < len) {
-		return 0;
-	}
+	for (int mb = 1; mb <= max_mb; mb *= 4) {
+		int len = mb * 1024 * 1024;
+		unsigned char *str = generate(len);
 
-	if (a + k >= len && b + k >= len) {
-		return y[a] == y[b];
+		double start = now_ms();
+		int *sa = sa_sort(str, len);
+		double sort_ms = now_ms() - start;
+
+		start = now_ms();
+		int *sais = sa_sais(str, len);
+		double sais_ms = now_ms() - start;
+
+		start = now_ms();
+		int64_t *sais64 = sa_sais64(str, len);
+		double sais64_ms = now_ms() - start;
+
+		assert(memcmp(sa, sais, len * sizeof(int)) == 0);
+		for (int i = 0; i < len; i++)
+			assert(sais64[i] == sa[i]);
+		printf("%8d %12.1f %12.1f %12.1f\n", mb, sort_ms, sais_ms, sais64_ms);
+
+		free(sais64);
+		free(sais);
+		free(sa);
+		free(str);
 	}
+}
 
-	return y[a] == y[b] && y[a + k] == y[b + k];
+static int naive_lcp(const unsigned char *str, int len, int a, int b)
+{
+	int h = 0;
+	while (a + h < len && b + h < len && str[a + h] == str[b + h])
+		h++;
+	return h;
 }
 
-// suffix array
-// radix sort + binary lifting
-// O(nlgn)
-int *sa_sort(const unsigned char *str, int len)
+// cross-check lcp_kasai and plcp_phi against direct comparison on small
+// inputs, then time both on mb MB of random bytes
+static int lcp_check(int mb)
 {
-	int count_len = len > R ? len + 1 : R + 1;
+	for (int iter = 0; iter < 2000; iter++) {
+		int len = 1 + rand() % 500;
+		int k = 1 + rand() % (iter % 2 ? 3 : 256);
+		unsigned char *str = malloc(len);
+		for (int i = 0; i < len; i++)
+			str[i] = 'a' + rand() % k;
+
+		int *sa = sa_sort(str, len);
+		int *lcp = lcp_kasai(str, sa, len);
+		int *plcp = plcp_phi(str, sa, len);
+		for (int i = 0; i < len; i++) {
+			int want = i ? naive_lcp(str, len, sa[i - 1], sa[i]) : 0;
+			if (lcp[i] != want || plcp[sa[i]] != want) {
+				printf("lcp mismatch: len %d, i %d\n", len, i);
+				return 1;
+			}
+		}
 
-	int *sa = malloc(len * sizeof(int));
-	int *x = malloc(len * sizeof(int));
-	int *y = malloc(len * sizeof(int));
-	int *count = malloc(count_len * sizeof(int));
-	memset(count, 0, count_len * sizeof(int));
-	
-	for (int i = 0; i < len; i++) {
-		x[i] = str[i];
-		count[str[i] + 1]++;
+		free(plcp);
+		free(lcp);
+		free(sa);
+		free(str);
 	}
+	printf("lcp: 2000 cases ok\n");
 
-	for (int i = 0; i < R; i++) {
-		count[i+1] += count[i];
-	}
+	int len = mb * 1024 * 1024;
+	unsigned char *str = generate_random_str(len);
+	int *sa = sa_sais(str, len);
 
-	for (int i = 0; i < len; i++) {
-		sa[count[str[i]]] = i;
-		count[str[i]]++;
-	}
+	double start = now_ms();
+	int *lcp = lcp_kasai(str, sa, len);
+	double kasai_ms = now_ms() - start;
 
-	int r = R;
-	for (int k = 1; k < len; k *= 2) {
-		// each loop is an LSD sort with d = 2
-		//
-		// LSD sort d = 0
-		int p = 0;
-		for (int i = len - k; i < len; i++) {
-			y[p] = i;
-			p++;
-		}
+	start = now_ms();
+	int *plcp = plcp_phi(str, sa, len);
+	double phi_ms = now_ms() - start;
 
-		for (int i = 0; i < len; i++) {
-			if (sa[i] >= k) {
-				y[p] = sa[i] - k;
-				p++;
-			}
-		}
+	int pos, best = lcp_longest_repeat(lcp, sa, len, &pos);
+	for (int i = 0; i < len; i++)
+		assert(plcp[sa[i]] == lcp[i]);
+	printf("%dMB: kasai %.1f ms, phi %.1f ms, longest repeat %d at %d\n",
+	       mb, kasai_ms, phi_ms, best, pos);
 
-		memset(count, 0, (r+1)*sizeof(int));
+	free(plcp);
+	free(lcp);
+	free(sa);
+	free(str);
 
-		// LSD sort d = 1
-		for (int i = 0; i < len; i++) {
-			count[x[y[i]] + 1]++;
-		}
+	return 0;
+}
 
-		for (int i = 0; i < r; i++) {
-			count[i+1] += count[i];
-		}
+static double mb_per_s(int len, double ms)
+{
+	return len / (1024.0 * 1024.0) / (ms / 1e3);
+}
 
-		for (int i = 0; i < len; i++) {
-			sa[count[x[y[i]]]] = y[i];
-			count[x[y[i]]]++;
-		}
+// BWT + MTF + RLE over mb MB of text and back, throughput per stage
+static int bwt_pipeline(int mb)
+{
+	int len = mb * 1024 * 1024;
+	unsigned char *str = generate_text(len);
+	unsigned char *buf = malloc(len);
+	unsigned char *rle = malloc(len * 3 / 2 + 1);
+
+	double start = now_ms();
+	int primary = bwt_forward(str, len, buf);
+	double bwt_ms = now_ms() - start;
+
+	start = now_ms();
+	mtf_encode(buf, len);
+	double mtf_ms = now_ms() - start;
+
+	start = now_ms();
+	int n = rle_encode(buf, len, rle);
+	double rle_ms = now_ms() - start;
+
+	start = now_ms();
+	int m = rle_decode(rle, n, buf, len);
+	double unrle_ms = now_ms() - start;
+	assert(m == len);
+
+	start = now_ms();
+	mtf_decode(buf, len);
+	double unmtf_ms = now_ms() - start;
+
+	unsigned char *out = malloc(len);
+	start = now_ms();
+	bwt_inverse(buf, len, primary, out);
+	double unbwt_ms = now_ms() - start;
+
+	if (memcmp(str, out, len) != 0) {
+		printf("bwt: round trip mismatch\n");
+		return 1;
+	}
 
-		// construct new x[]
-		memcpy(y, x, len * sizeof(int));
+	printf("%dMB of text, rle output %.1f%% of input\n", mb, 100.0 * n / len);
+	printf("%8s %12s %12s\n", "stage", "fwd MB/s", "inv MB/s");
+	printf("%8s %12.1f %12.1f\n", "bwt", mb_per_s(len, bwt_ms), mb_per_s(len, unbwt_ms));
+	printf("%8s %12.1f %12.1f\n", "mtf", mb_per_s(len, mtf_ms), mb_per_s(len, unmtf_ms));
+	printf("%8s %12.1f %12.1f\n", "rle", mb_per_s(len, rle_ms), mb_per_s(len, unrle_ms));
 
-		x[sa[0]] = r = 0;
-		for (int i = 1; i < len; i++) {
-			if (!equal(y, len, sa[i-1], sa[i], k)) {
-				r++;
-			}
-			x[sa[i]] = r;
-		}
+	free(out);
+	free(rle);
+	free(buf);
+	free(str);
 
-		assert(r < len);
+	return 0;
+}
+
+// sa_sort_mt on 1, 2, 4, ... max_threads threads against sa_sort
+static void bench_mt(int mb, int max_threads)
+{
+	int len = mb * 1024 * 1024;
+	unsigned char *str = generate_random_str(len);
+
+	double start = now_ms();
+	int *sa = sa_sort(str, len);
+	double sort_ms = now_ms() - start;
+	printf("%dMB, %d CPUs online, sa_sort %.1f ms\n", mb, sa_threads(), sort_ms);
+	// against sa_sort, the break-even thread count is where it passes 1
+	printf("%8s %12s %10s %10s\n", "threads", "ms", "speedup", "vs sa_sort");
+
+	double base = 0;
+	for (int t = 1; t <= max_threads; t *= 2) {
+		start = now_ms();
+		int *mt = sa_sort_mt(str, len, t);
+		double ms = now_ms() - start;
+		if (t == 1)
+			base = ms;
+
+		assert(memcmp(sa, mt, len * sizeof(int)) == 0);
+		printf("%8d %12.1f %9.2fx %9.2fx\n", t, ms, base / ms, sort_ms / ms);
+		free(mt);
+	}
 
-		if (r == len - 1) {
-			break;
+	free(sa);
+	free(str);
+}
+
+// FM-index over mb MB of text: size, and count/locate on random
+// substrings of the text
+static void bench_fm(int mb)
+{
+	int len = mb * 1024 * 1024, nq = 100000, plen = 16;
+	unsigned char *str = generate_text(len);
+	int *out = malloc(len * sizeof(int));
+
+	double start = now_ms();
+	struct fm_index *fm = fm_build(str, len, 0);
+	double build_ms = now_ms() - start;
+	printf("%dMB of text: build %.1f ms, %.2f bytes/char (text + SA: 5)\n",
+	       mb, build_ms, (double)fm_size(fm) / len);
+
+	long total = 0;
+	start = now_ms();
+	for (int q = 0; q < nq; q++)
+		total += fm_count(fm, str + rand() % (len - plen), plen);
+	double count_ms = now_ms() - start;
+
+	// text patterns repeat a lot, stop after a million positions
+	long located = 0;
+	start = now_ms();
+	while (located < 1000000)
+		located += fm_locate(fm, str + rand() % (len - plen), plen, out, len);
+	double locate_ms = now_ms() - start;
+
+	printf("count: %.0f queries/s (%ld hits), locate: %.0f positions/s\n",
+	       nq / (count_ms / 1e3), total, located / (locate_ms / 1e3));
+
+	fm_free(fm);
+	free(out);
+	free(str);
+}
+
+// occurrences of p in str by KMP scanning
+static int kmp_count(const unsigned char *str, int len, const unsigned char *p, int plen)
+{
+	int *fail = malloc(plen * sizeof(int));
+	int count = 0;
+
+	fail[0] = 0;
+	for (int i = 1, k = 0; i < plen; i++) {
+		while (k > 0 && p[i] != p[k])
+			k = fail[k - 1];
+		if (p[i] == p[k])
+			k++;
+		fail[i] = k;
+	}
+	for (int i = 0, k = 0; i < len; i++) {
+		while (k > 0 && str[i] != p[k])
+			k = fail[k - 1];
+		if (str[i] == p[k])
+			k++;
+		if (k == plen) {
+			count++;
+			k = fail[k - 1];
 		}
 	}
 
-	free(count);
-	free(x);
-	free(y);
+	free(fail);
+	return count;
+}
 
-	return sa;
+// sa_find, sa_find_batch and KMP on the same queries over mb MB of text
+static void bench_find(int mb)
+{
+	int len = mb * 1024 * 1024, nq = 200000, nkmp = 20;
+	unsigned char *str = generate_text(len);
+	int *sa = sa_sais(str, len);
+	const unsigned char **ps = malloc(nq * sizeof(*ps));
+	int *plens = malloc(nq * sizeof(int));
+	int *lo = malloc(nq * sizeof(int)), *hi = malloc(nq * sizeof(int));
+
+	// substrings of the text, every fourth one with a byte changed
+	unsigned char *pool = malloc(nq * 32);
+	for (int q = 0; q < nq; q++) {
+		unsigned char *p = pool + q * 32;
+		plens[q] = 4 + rand() % 28;
+		memcpy(p, str + rand() % (len - plens[q]), plens[q]);
+		if (q % 4 == 0)
+			p[rand() % plens[q]] = 'A' + rand() % 26;
+		ps[q] = p;
+	}
+
+	long hits = 0;
+	double start = now_ms();
+	for (int q = 0; q < nq; q++) {
+		int l, h;
+		hits += sa_find(str, len, sa, ps[q], plens[q], &l, &h);
+	}
+	double find_ms = now_ms() - start;
+
+	start = now_ms();
+	sa_find_batch(str, len, sa, ps, plens, nq, lo, hi);
+	double batch_ms = now_ms() - start;
+
+	long batch_hits = 0;
+	for (int q = 0; q < nq; q++)
+		batch_hits += hi[q] - lo[q];
+	assert(batch_hits == hits);
+
+	start = now_ms();
+	for (int q = 0; q < nkmp; q++)
+		assert(kmp_count(str, len, ps[q], plens[q]) == hi[q] - lo[q]);
+	double kmp_ms = now_ms() - start;
+
+	printf("%dMB of text, %d queries, %ld hits\n", mb, nq, hits);
+	printf("%10s %14s\n", "", "queries/s");
+	printf("%10s %14.0f\n", "sa_find", nq / (find_ms / 1e3));
+	printf("%10s %14.0f\n", "batch", nq / (batch_ms / 1e3));
+	printf("%10s %14.1f\n", "kmp", nkmp / (kmp_ms / 1e3));
+
+	free(pool);
+	free(hi);
+	free(lo);
+	free(plens);
+	free(ps);
+	free(sa);
+	free(str);
 }
 
-static char random_char()
+// size bytes mapped shared from an unlinked file next to path, so the
+// pages are written back there under memory pressure instead of
+// needing swap; NULL on failure
+static void *map_scratch(const char *path, size_t size)
 {
-	static int init = 0;
-	if (init == 0) {
-		init = 1;
-		srand(time(NULL));
+	char *name = malloc(strlen(path) + sizeof(".XXXXXX"));
+	assert(name);
+	sprintf(name, "%s.XXXXXX", path);
+
+	void *p = MAP_FAILED;
+	int fd = mkstemp(name);
+	if (fd >= 0) {
+		unlink(name);
+		if (ftruncate(fd, size) == 0)
+			p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+		close(fd);
 	}
+	if (p == MAP_FAILED)
+		fprintf(stderr, "%s: %s\n", name, strerror(errno));
+	free(name);
 
-	return rand() % 256;
+	return p == MAP_FAILED ? NULL : p;
 }
 
-static unsigned char *generate_random_str(int len)
+// SA (or CSA) of the file in, mapped read-only, written straight into
+// out mapped shared: native-endian int32 entries, int64 past INT_MAX.
+// The CSA's doubling workspace is mapped from a scratch file as well.
+static int index_file(const char *in, const char *out, int circular)
 {
-	char *str = malloc(len);
-	for (int i = 0; i < len; i++) {
-		str[i] = random_char();
+	int fd = open(in, O_RDONLY);
+	if (fd < 0) {
+		fprintf(stderr, "%s: %s\n", in, strerror(errno));
+		return 1;
 	}
-	return str;
+	struct stat st;
+	if (fstat(fd, &st) < 0) {
+		fprintf(stderr, "%s: %s\n", in, strerror(errno));
+		close(fd);
+		return 1;
+	}
+	int64_t len = st.st_size;
+	int wide = len > INT_MAX;
+	size_t width = wide ? sizeof(int64_t) : sizeof(int);
+
+	const unsigned char *str = NULL;
+	if (len > 0) {
+		str = mmap(NULL, len, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (str == MAP_FAILED) {
+			fprintf(stderr, "%s: mmap: %s\n", in, strerror(errno));
+			close(fd);
+			return 1;
+		}
+	}
+	close(fd);
+
+	fd = open(out, O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0 || ftruncate(fd, len * width) < 0) {
+		fprintf(stderr, "%s: %s\n", out, strerror(errno));
+		if (fd >= 0)
+			close(fd);
+		if (len > 0)
+			munmap((void *)str, len);
+		return 1;
+	}
+	void *sa = NULL;
+	if (len > 0) {
+		sa = mmap(NULL, len * width, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+		if (sa == MAP_FAILED) {
+			fprintf(stderr, "%s: mmap: %s\n", out, strerror(errno));
+			close(fd);
+			munmap((void *)str, len);
+			return 1;
+		}
+	}
+	close(fd);
+
+	void *work = NULL;
+	size_t work_size = 0;
+	if (circular && len > 0) {
+		work_size = wide ? csa_work_size64(len) : csa_work_size(len);
+		work = map_scratch(out, work_size);
+		if (!work) {
+			munmap(sa, len * width);
+			munmap((void *)str, len);
+			return 1;
+		}
+	}
+
+	double start = now_ms();
+	if (len > 0) {
+		if (circular && wide)
+			csa_sort_buf64(str, len, sa, work);
+		else if (circular)
+			csa_sort_buf(str, len, sa, work);
+		else if (wide)
+			sa_sais_buf64(str, len, sa);
+		else
+			sa_sais_buf(str, len, sa);
+		if (work)
+			munmap(work, work_size);
+		munmap(sa, len * width);
+		munmap((void *)str, len);
+	}
+	printf("%s: %lld bytes, %s with %d-bit entries in %.1f ms\n", out,
+	       (long long)len, circular ? "csa" : "sa", (int)width * 8, now_ms() - start);
+
+	return 0;
 }
 
 int main(int argc, char *argv[])
 {
+	if (argc >= 2 && strcmp(argv[1], "bench") == 0) {
+		unsigned char *(*generate)(int) = generate_random_str;
+		if (argc > 3 && strcmp(argv[3], "text") == 0)
+			generate = generate_text;
+		else if (argc > 3 && strcmp(argv[3], "fib") == 0)
+			generate = generate_fib;
+		bench(argc > 2 ? atoi(argv[2]) : 64, generate);
+		return 0;
+	}
+	if (argc >= 2 && strcmp(argv[1], "lcp") == 0)
+		return lcp_check(argc > 2 ? atoi(argv[2]) : 16);
+	if (argc >= 2 && strcmp(argv[1], "mt") == 0) {
+		bench_mt(argc > 2 ? atoi(argv[2]) : 16, argc > 3 ? atoi(argv[3]) : sa_threads());
+		return 0;
+	}
+	if (argc >= 2 && strcmp(argv[1], "fm") == 0) {
+		bench_fm(argc > 2 ? atoi(argv[2]) : 16);
+		return 0;
+	}
+	if (argc >= 2 && strcmp(argv[1], "find") == 0) {
+		bench_find(argc > 2 ? atoi(argv[2]) : 16);
+		return 0;
+	}
+	if (argc >= 2 && strcmp(argv[1], "bwt") == 0)
+		return bwt_pipeline(argc > 2 ? atoi(argv[2]) : 4);
+	if (argc >= 4 && (strcmp(argv[1], "sa") == 0 || strcmp(argv[1], "csa") == 0))
+		return index_file(argv[2], argv[3], argv[1][0] == 'c');
+
 	unsigned char *str = "ABRACADABRA!";
 	int len = 12;
 	if (argc == 2) {
@@ -0,0 +1,96 @@
+#ifndef __SA_H
+#define __SA_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define R 256
+
+// every builder returns a malloc'd array of len suffix/rotation starts
+
+// circular suffix array, prefix doubling over unsorted groups, O(nlgn)
+int *csa_sort(const unsigned char *str, int len);
+// circular suffix array, LSD sort, O(n^2)
+int *lsd_sort(const unsigned char *str, int len);
+// 3-way radix quicksort on characters, falls back to doubling on deep ties
+int *csa_quick3way(const unsigned char *str, int len);
+int *sa_quick3way(const unsigned char *str, int len);
+// suffix array, prefix doubling over unsorted groups, O(nlgn)
+int *sa_sort(const unsigned char *str, int len);
+
+// suffix array, induced sorting (SA-IS), O(n)
+// no workspace beyond the output apart from two 256-entry bucket arrays
+int *sa_sais(const unsigned char *str, int len);
+
+// the same into a caller's buffer of len entries, e.g. a mapped file
+void sa_sais_buf(const unsigned char *str, int len, int *sa);
+// doubling needs csa_work_size(len) bytes of workspace, about 7 entries
+// per input byte at worst: work is such a buffer, or NULL to malloc it
+size_t csa_work_size(int len);
+void csa_sort_buf(const unsigned char *str, int len, int *csa, void *work);
+
+// 64-bit index variants for inputs past INT_MAX, same algorithms
+int64_t *csa_sort64(const unsigned char *str, int64_t len);
+int64_t *csa_quick3way64(const unsigned char *str, int64_t len);
+int64_t *sa_quick3way64(const unsigned char *str, int64_t len);
+int64_t *sa_sort64(const unsigned char *str, int64_t len);
+int64_t *sa_sais64(const unsigned char *str, int64_t len);
+void sa_sais_buf64(const unsigned char *str, int64_t len, int64_t *sa);
+size_t csa_work_size64(int64_t len);
+void csa_sort_buf64(const unsigned char *str, int64_t len, int64_t *csa, void *work);
+
+// suffix array, prefix doubling over unsorted groups split between
+// nthreads threads (<= 0: one per online CPU, fewer if they cannot be
+// started), same output as sa_sort
+int *sa_sort_mt(const unsigned char *str, int len, int nthreads);
+int sa_threads(void);
+
+// SA-IS with 32-bit indices when len fits, 64-bit otherwise; *wide
+// tells which, the result is int * or int64_t * accordingly
+void *sa_build(const unsigned char *str, int64_t len, int *wide);
+
+// LCP of a suffix array: lcp[i] = lcp(sa[i - 1], sa[i]), lcp[0] = 0
+// Kasai et al., O(n) with an n-int rank array as workspace
+int *lcp_kasai(const unsigned char *str, const int *sa, int len);
+// permuted LCP, plcp[sa[i]] == lcp[i], O(n) without any workspace
+int *plcp_phi(const unsigned char *str, const int *sa, int len);
+int *lcp_from_plcp(const int *plcp, const int *sa, int len);
+// length and a start of the longest repeated substring, *pos -1 if none
+int lcp_longest_repeat(const int *lcp, const int *sa, int len, int *pos);
+
+// BWT: last column of csa_sort's rotations into out, returns the row
+// of the original string (primary index)
+int bwt_forward(const unsigned char *str, int len, unsigned char *out);
+void bwt_inverse(const unsigned char *bwt, int len, int primary, unsigned char *out);
+// move-to-front, in place
+void mtf_encode(unsigned char *buf, int len);
+void mtf_decode(unsigned char *buf, int len);
+// byte run-length coding, out needs len * 3 / 2 + 1 bytes; decode
+// returns the decoded length or -1 if it would exceed cap
+int rle_encode(const unsigned char *in, int len, unsigned char *out);
+int rle_decode(const unsigned char *in, int len, unsigned char *out, int cap);
+
+// rows [*lo, *hi) of sa whose suffixes start with p, returns the count
+int sa_find(const unsigned char *str, int len, const int *sa,
+	    const unsigned char *p, int plen, int *lo, int *hi);
+// n queries at once, sorted internally so each search starts from the
+// previous lower bound; answers land in lo[i], hi[i] in input order
+void sa_find_batch(const unsigned char *str, int len, const int *sa,
+		   const unsigned char **ps, const int *plens, int n,
+		   int *lo, int *hi);
+
+// FM-index: BWT in a Huffman-shaped wavelet tree, about n(H0 + 1)
+// bits, plus a suffix array sampled every sample text positions
+// (<= 0: 64), packed and with its rows Elias-Fano coded: another
+// 0.05n bytes at the default. Zero-order only, see README.md
+struct fm_index;
+struct fm_index *fm_build(const unsigned char *str, int len, int sample);
+void fm_free(struct fm_index *fm);
+size_t fm_size(const struct fm_index *fm);
+// occurrences of p in str
+int fm_count(const struct fm_index *fm, const unsigned char *p, int plen);
+// same, and the first max of their start positions (unordered) into out
+int fm_locate(const struct fm_index *fm, const unsigned char *p, int plen,
+	      int *out, int max);
+
+#endif
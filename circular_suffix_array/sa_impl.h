@@ -0,0 +1,451 @@
+/*
+ * builders templated on the index type, included once per width:
+ *
+ *   #define IDX int64_t
+ *   #define KEY unsigned __int128   // holds two IDX
+ *   #define SFX(name) name##64
+ *   #include "sa_impl.h"
+ *
+ * no include guard on purpose. sa_mt.c defines SA_IMPL_GROUPS_ONLY to
+ * take just the group sorting helpers, with PAYLOAD and SUFFIX.
+ */
+
+// rank in the high half of a KEY, suffix in the low half, so a radix
+// pass moves both with one word and never touches the payload bits
+#define PAYLOAD (8 * sizeof(IDX))
+#define SUFFIX(key) ((IDX)((key) & (((KEY)1 << PAYLOAD) - 1)))
+
+// stable sort of n keys by rank, ranks all within [min, max]
+static void SFX(sort_keys)(KEY *a, KEY *aux, IDX n, IDX min, IDX max)
+{
+	if (n < 32) {
+		for (IDX i = 1; i < n; i++) {
+			KEY v = a[i];
+			IDX j = i;
+			for (; j > 0 && a[j-1] >> PAYLOAD > v >> PAYLOAD; j--)
+				a[j] = a[j-1];
+			a[j] = v;
+		}
+		return;
+	}
+
+	KEY *from = a, *to = aux;
+	for (int shift = 0; shift < (int)PAYLOAD && (max - min) >> shift; shift += 8) {
+		IDX count[R+1] = { 0 };
+
+		for (IDX i = 0; i < n; i++)
+			count[(((IDX)(from[i] >> PAYLOAD) - min) >> shift & (R - 1)) + 1]++;
+		for (int i = 0; i < R; i++)
+			count[i+1] += count[i];
+		for (IDX i = 0; i < n; i++)
+			to[count[((IDX)(from[i] >> PAYLOAD) - min) >> shift & (R - 1)]++] = from[i];
+
+		KEY *tmp = from;
+		from = to;
+		to = tmp;
+	}
+	if (from != a)
+		memcpy(a, from, n * sizeof(KEY));
+}
+
+// sort the group of n keyed suffixes at row first, ranks all within
+// [min, max], write it back to sa and x and append the (first row,
+// size) pairs it splits into that still hold two or more suffixes to
+// next. Returns how many ints were appended; x is only written.
+static IDX SFX(split_group)(IDX *sa, IDX *x, KEY *key, KEY *aux,
+			    IDX first, IDX n, IDX min, IDX max, IDX *next)
+{
+	IDX nnext = 0;
+
+	if (min == max) {
+		next[nnext++] = first;
+		next[nnext++] = n;
+		return nnext;
+	}
+
+	SFX(sort_keys)(key, aux, n, min, max);
+
+	// write back, split where the rank changes
+	IDX head = 0;
+	for (IDX t = 0; t < n; t++) {
+		if (t > 0 && key[t] >> PAYLOAD != key[t-1] >> PAYLOAD) {
+			if (t - head >= 2) {
+				next[nnext++] = first + head;
+				next[nnext++] = t - head;
+			}
+			head = t;
+		}
+		IDX i = SUFFIX(key[t]);
+		sa[first + t] = i;
+		x[i] = first + head;
+	}
+	if (n - head >= 2) {
+		next[nnext++] = first + head;
+		next[nnext++] = n - head;
+	}
+	return nnext;
+}
+
+#ifndef SA_IMPL_GROUPS_ONLY
+
+typedef int (*SFX(char_at_func_t))(const unsigned char *, IDX, IDX, IDX);
+
+// suffix + i may not fit IDX when len is close to its max, compare
+// against what is left of the string instead
+static int SFX(sa_char_at)(const unsigned char *str, IDX len, IDX suffix, IDX i)
+{
+	assert(suffix >= 0 && suffix < len && i >= 0 && i < len);
+	return i >= len - suffix ? -1 : str[suffix+i];
+}
+
+static int SFX(csa_char_at)(const unsigned char *str, IDX len, IDX suffix, IDX i)
+{
+	assert(suffix >= 0 && suffix < len && i >= 0 && i < len);
+	return str[i >= len - suffix ? i - (len - suffix) : suffix + i];
+}
+
+// prefix doubling that only revisits groups still holding more than one
+// suffix (Larsson & Sadakane): x[i] is the first row of i's group, and
+// groups are refined in place, so ranks updated earlier in a round are
+// already finer, never wrong. Each group is sorted on its own by the
+// rank at i + k with packed keys; no modulo, no full re-ranking pass.
+// i + k and 2k pass INT_MAX long before len does, they are int64_t.
+//
+// sa must be in order up to the first k characters, the (first row,
+// size) pairs in groups[0, ngrp) being the rows still tied there.
+
+// workspace for refine() over groups of total suffixes: the key
+// buffers first, so they keep the alignment of work, then the lists
+static size_t SFX(refine_work_size)(IDX total)
+{
+	return 2 * (size_t)total * sizeof(KEY) + 2 * ((size_t)total + 1) * sizeof(IDX);
+}
+
+// work is NULL or refine_work_size(total) bytes, else it mallocs
+static void SFX(refine)(IDX len, int circular, IDX *sa, IDX *x,
+			const IDX *groups, IDX ngrp, int64_t k, void *work)
+{
+	IDX total = 0, widest = 0;
+
+	for (IDX g = 0; g < ngrp; g += 2) {
+		total += groups[g+1];
+		if (groups[g+1] > widest)
+			widest = groups[g+1];
+	}
+
+	// groups only ever split: at most total / 2 pairs, and the widest
+	// first one bounds the key buffers
+	KEY *key, *aux;
+	IDX *grp, *next;
+	if (work) {
+		key = work;
+		aux = key + total;
+		grp = (IDX *)(aux + total);
+		next = grp + total + 1;
+	} else {
+		key = malloc(widest * sizeof(KEY));
+		aux = malloc(widest * sizeof(KEY));
+		grp = malloc(((size_t)total + 1) * sizeof(IDX));
+		next = malloc(((size_t)total + 1) * sizeof(IDX));
+		assert(key && aux && grp && next);
+	}
+	memcpy(grp, groups, ngrp * sizeof(IDX));
+
+	for (; ngrp > 0 && k < len; k *= 2) {
+		IDX nnext = 0;
+
+		for (IDX g = 0; g < ngrp; g += 2) {
+			IDX first = grp[g], n = grp[g+1];
+			IDX min = len, max = 0;
+
+			for (IDX t = 0; t < n; t++) {
+				IDX i = sa[first + t], r;
+				int64_t j = i + k;
+				if (circular)
+					r = x[j >= len ? j - len : j];
+				else
+					r = j < len ? x[j] + 1 : 0;
+				if (r < min)
+					min = r;
+				if (r > max)
+					max = r;
+				key[t] = (KEY)r << PAYLOAD | (KEY)i;
+			}
+			nnext += SFX(split_group)(sa, x, key, aux, first, n,
+						  min, max, next + nnext);
+		}
+
+		IDX *tmp = grp;
+		grp = next;
+		next = tmp;
+		ngrp = nnext;
+	}
+
+	if (!work) {
+		free(aux);
+		free(key);
+		free(next);
+		free(grp);
+	}
+}
+
+// refine()'s workspace for every suffix, then x
+static size_t SFX(doubling_work_size)(IDX len)
+{
+	return SFX(refine_work_size)(len) + (size_t)len * sizeof(IDX);
+}
+
+// buckets by first character, then refines them from k = 1; work is
+// NULL or doubling_work_size(len) bytes, else it mallocs
+static void SFX(doubling)(const unsigned char *str, IDX len, int circular, IDX *sa, void *work)
+{
+	IDX count[R+1] = { 0 };
+	IDX grp[2 * R], ngrp = 0;
+	IDX *x = work ? (IDX *)((char *)work + SFX(refine_work_size)(len))
+		      : malloc(len * sizeof(IDX));
+	assert(x);
+
+	for (IDX i = 0; i < len; i++)
+		count[str[i] + 1]++;
+	for (int i = 0; i < R; i++) {
+		if (count[i+1] >= 2) {
+			grp[ngrp++] = count[i];
+			grp[ngrp++] = count[i+1];
+		}
+		count[i+1] += count[i];
+	}
+	for (IDX i = 0; i < len; i++)
+		x[i] = count[str[i]];
+	for (IDX i = 0; i < len; i++)
+		sa[count[str[i]]++] = i;
+
+	SFX(refine)(len, circular, sa, x, grp, ngrp, 1, work);
+	if (!work)
+		free(x);
+}
+
+#undef SUFFIX
+#undef PAYLOAD
+
+// circular suffix array
+// prefix doubling, O(nlgn)
+IDX *SFX(csa_sort)(const unsigned char *str, IDX len)
+{
+	IDX *csa = malloc(len * sizeof(IDX));
+	assert(csa);
+
+	SFX(doubling)(str, len, 1, csa, NULL);
+	return csa;
+}
+
+size_t SFX(csa_work_size)(IDX len)
+{
+	return SFX(doubling_work_size)(len);
+}
+
+void SFX(csa_sort_buf)(const unsigned char *str, IDX len, IDX *csa, void *work)
+{
+	SFX(doubling)(str, len, 1, csa, work);
+}
+
+static void SFX(exch)(IDX *a, IDX x, IDX y)
+{
+	IDX tmp = a[x];
+	a[x] = a[y];
+	a[y] = tmp;
+}
+
+// multikey quicksort leaves ranges still tied this deep to doubling,
+// which keeps aaaa... and friends at O(nlgn). Once more than len /
+// TIED_MAX suffixes are tied the input is repetitive all over, and
+// reaching DEPTH_LIMIT everywhere would cost more than doubling it all.
+#define DEPTH_LIMIT 256
+#define CUTOFF 16
+#define TIED_MAX 32
+
+// compare suffixes a and b from depth d on, 2 if still tied at the limit
+static int SFX(suffix_cmp)(const unsigned char *str, IDX len, IDX a, IDX b, IDX d, SFX(char_at_func_t) char_at)
+{
+	for (IDX t = d; t < len; t++) {
+		if (t >= DEPTH_LIMIT)
+			return 2;
+		int ca = char_at(str, len, a, t), cb = char_at(str, len, b, t);
+		if (ca != cb)
+			return ca < cb ? -1 : 1;
+	}
+	return 0;
+}
+
+// [lo, hi) known equal up to d, sorted on their first DEPTH_LIMIT
+// characters: suffixes tied there end up next to each other
+static void SFX(insertion)(const unsigned char *str, IDX len, IDX *sa, IDX lo, IDX hi, IDX d, SFX(char_at_func_t) char_at)
+{
+	for (IDX i = lo + 1; i < hi; i++) {
+		for (IDX j = i; j > lo; j--) {
+			if (SFX(suffix_cmp)(str, len, sa[j-1], sa[j], d, char_at) != 1)
+				break;
+			SFX(exch)(sa, j - 1, j);
+		}
+	}
+}
+
+// 3-way radix quicksort on an explicit stack of (lo, hi, d), median of
+// three pivots and insertion sort for small ranges. Ranges still tied
+// at DEPTH_LIMIT are left as they are and returned in *tied as (first
+// row, size) pairs, the count of ints is returned; -1 once too many
+// are tied, sa is then only partly sorted.
+static IDX SFX(sort)(const unsigned char *str, IDX len, IDX *sa, SFX(char_at_func_t) char_at, IDX **tied)
+{
+	// disjoint ranges of two or more, so at most 3 * len / 2 entries
+	IDX cap = 3 * 64, top = 0;
+	IDX *stack = malloc(cap * sizeof(IDX));
+	IDX tcap = 2 * 16, ntied = 0, ntiedsfx = 0;
+	*tied = malloc(tcap * sizeof(IDX));
+	assert(stack && *tied);
+
+#define TIE(l, h) do {							\
+		if (ntied + 2 > tcap) {					\
+			tcap *= 2;					\
+			*tied = realloc(*tied, tcap * sizeof(IDX));	\
+			assert(*tied);					\
+		}							\
+		(*tied)[ntied++] = (l);					\
+		(*tied)[ntied++] = (h) - (l);				\
+		ntiedsfx += (h) - (l);					\
+	} while (0)
+
+#define PUSH(l, h, dd) do {						\
+		if ((h) - (l) >= 2) {					\
+			if (top + 3 > cap) {				\
+				cap *= 2;				\
+				stack = realloc(stack, cap * sizeof(IDX)); \
+				assert(stack);				\
+			}						\
+			stack[top++] = (l);				\
+			stack[top++] = (h);				\
+			stack[top++] = (dd);				\
+		}							\
+	} while (0)
+
+	PUSH(0, len, 0);
+	while (top > 0) {
+		IDX d = stack[--top], hi = stack[--top], lo = stack[--top];
+
+		if (d >= len)
+			continue;
+		if (ntiedsfx > len / TIED_MAX) {
+			ntied = -1;
+			break;
+		}
+		if (d >= DEPTH_LIMIT) {
+			TIE(lo, hi);
+			continue;
+		}
+		if (hi - lo < CUTOFF) {
+			SFX(insertion)(str, len, sa, lo, hi, d, char_at);
+			// runs of neighbours still tied at the limit
+			for (IDX t = lo + 1, head = lo; t <= hi; t++) {
+				if (t < hi && SFX(suffix_cmp)(str, len, sa[t-1], sa[t], d, char_at) == 2)
+					continue;
+				if (t - head >= 2)
+					TIE(head, t);
+				head = t;
+			}
+			continue;
+		}
+
+		// median of first, middle and last to the front
+		IDX mid = lo + (hi - lo) / 2;
+		int a = char_at(str, len, sa[lo], d);
+		int b = char_at(str, len, sa[mid], d);
+		int c = char_at(str, len, sa[hi-1], d);
+		if ((a < b && b < c) || (c < b && b < a))
+			SFX(exch)(sa, lo, mid);
+		else if ((b < c && c < a) || (a < c && c < b))
+			SFX(exch)(sa, lo, hi - 1);
+
+		IDX lt = lo, gt = hi - 1;
+		int v = char_at(str, len, sa[lo], d);
+		IDX i = lo + 1;
+
+		while (i <= gt) {
+			int t = char_at(str, len, sa[i], d);
+			if (t < v)
+				SFX(exch)(sa, lt++, i++);
+			else if (t > v) {
+				SFX(exch)(sa, i, gt--);
+			} else {
+				i++;
+			}
+		}
+
+		PUSH(lo, lt, d);
+		PUSH(gt + 1, hi, d);
+		if (v >= 0)
+			PUSH(lt, gt + 1, d + 1);
+	}
+#undef PUSH
+#undef TIE
+
+	free(stack);
+	return ntied;
+}
+
+// sorting the suffix array or the circular suffix array
+// depends on char_at()
+IDX *SFX(__quick3way)(const unsigned char *str, IDX len, SFX(char_at_func_t) char_at, int circular)
+{
+	IDX *sa = (IDX *)malloc(len * sizeof(IDX));
+	assert(sa);
+
+	for (IDX i = 0; i < len; i++) {
+		sa[i] = i;
+	}
+
+	IDX *tied, ntied = SFX(sort)(str, len, sa, char_at, &tied);
+	if (ntied < 0) {
+		SFX(doubling)(str, len, circular, sa, NULL);
+	} else if (ntied > 0) {
+		// everything else is in place, and the tied ranges share their
+		// first DEPTH_LIMIT characters: refine just those from there
+		IDX *x = malloc(len * sizeof(IDX));
+		assert(x);
+		for (IDX r = 0; r < len; r++)
+			x[sa[r]] = r;
+		for (IDX g = 0; g < ntied; g += 2)
+			for (IDX t = 0; t < tied[g+1]; t++)
+				x[sa[tied[g] + t]] = tied[g];
+		SFX(refine)(len, circular, sa, x, tied, ntied, DEPTH_LIMIT, NULL);
+		free(x);
+	}
+	free(tied);
+
+	return sa;
+}
+
+#undef TIED_MAX
+#undef CUTOFF
+#undef DEPTH_LIMIT
+
+IDX *SFX(csa_quick3way)(const unsigned char *str, IDX len)
+{
+	return SFX(__quick3way)(str, len, SFX(csa_char_at), 1);
+}
+
+IDX *SFX(sa_quick3way)(const unsigned char *str, IDX len)
+{
+	return SFX(__quick3way)(str, len, SFX(sa_char_at), 0);
+}
+
+// suffix array
+// prefix doubling, O(nlgn)
+IDX *SFX(sa_sort)(const unsigned char *str, IDX len)
+{
+	IDX *sa = malloc(len * sizeof(IDX));
+	assert(sa);
+
+	SFX(doubling)(str, len, 0, sa, NULL);
+	return sa;
+}
+
+#endif // SA_IMPL_GROUPS_ONLY
@@ -0,0 +1,236 @@
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <assert.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#include "sa.h"
+
+/*
+ * prefix doubling spread over threads, skipping sorted groups the way
+ * sa_sort does: only groups still holding more than one suffix are
+ * revisited, each sorted on its own by the rank at i + k. Every round
+ * the groups are cut into nthreads runs of about the same number of
+ * suffixes. x is read in one phase and rewritten in the next, so all
+ * threads see the ranks of the previous round; sa_sort can update them
+ * in place, threads racing on x could not. The workers live for the
+ * whole build and meet at barriers between phases, thread 0 does the
+ * small serial parts (cutting and collecting the group lists).
+ */
+
+// the group sorting helpers of the 32-bit sa_sort
+#define IDX int
+#define KEY uint64_t
+#define SFX(name) name
+#define SA_IMPL_GROUPS_ONLY
+#include "sa_impl.h"
+
+struct mt {
+	const unsigned char *str;
+	int len;
+	int nthreads;
+
+	int *sa;
+	int *x;          // first row of i's group
+	uint64_t *key;   // by row, only rows of unsorted groups are used
+	uint64_t *aux;
+
+	// unsorted groups as (first row, size) pairs, this round and next
+	int *grp, *next;
+	int ngrp;
+	// thread t sorts grp pairs [cut[t], cut[t+1]) and writes its new
+	// groups to next + base[t], nnext[t] ints of them
+	int *cut, *base, *nnext;
+	int64_t k;
+
+	// held until nthreads is down to the threads that did start
+	pthread_mutex_t start;
+	pthread_barrier_t bar;
+};
+
+struct worker {
+	struct mt *m;
+	int id;
+	pthread_t tid;
+};
+
+// groups in grp[0, ngrp) cut into nthreads runs of similar total size
+static void cut_groups(struct mt *m)
+{
+	int64_t total = 0, sum = 0;
+	int t = 1;
+
+	for (int g = 0; g < m->ngrp; g += 2)
+		total += m->grp[g+1];
+
+	m->cut[0] = 0;
+	m->base[0] = 0;
+	for (int g = 0; g < m->ngrp && t < m->nthreads; g += 2) {
+		sum += m->grp[g+1];
+		// a run ends once it holds its share, the next starts after it
+		while (t < m->nthreads && sum * m->nthreads >= total * t) {
+			m->cut[t] = g + 2;
+			m->base[t] = sum;
+			t++;
+		}
+	}
+	for (; t <= m->nthreads; t++) {
+		m->cut[t] = m->ngrp;
+		m->base[t] = sum;
+	}
+}
+
+static void *worker_main(void *arg)
+{
+	struct worker *w = arg;
+	struct mt *m = w->m;
+	int id = w->id, len = m->len;
+
+	pthread_mutex_lock(&m->start);
+	pthread_mutex_unlock(&m->start);
+
+	while (m->ngrp > 0) {
+		int from = m->cut[id], to = m->cut[id + 1];
+		int64_t k = m->k;
+
+		// ranks at i + k, read before anyone rewrites x
+		for (int g = from; g < to; g += 2) {
+			int first = m->grp[g], n = m->grp[g+1];
+			for (int t = 0; t < n; t++) {
+				int i = m->sa[first + t];
+				int64_t j = i + k;
+				int r = j < len ? m->x[j] + 1 : 0;
+				m->key[first + t] = (KEY)r << PAYLOAD | (KEY)i;
+			}
+		}
+		pthread_barrier_wait(&m->bar);
+
+		// a run of groups with s suffixes splits into at most s / 2
+		// groups, s ints of pairs, so the runs never overlap in next
+		int *next = m->next + m->base[id], nnext = 0;
+		for (int g = from; g < to; g += 2) {
+			int first = m->grp[g], n = m->grp[g+1];
+			uint64_t *key = m->key + first;
+			int min = len, max = 0;
+
+			for (int t = 0; t < n; t++) {
+				int r = key[t] >> PAYLOAD;
+				if (r < min)
+					min = r;
+				if (r > max)
+					max = r;
+			}
+			nnext += split_group(m->sa, m->x, key, m->aux + first, first, n,
+					     min, max, next + nnext);
+		}
+		m->nnext[id] = nnext;
+		pthread_barrier_wait(&m->bar);
+
+		// gather the runs' new groups, still in row order
+		if (id == 0) {
+			int ngrp = 0;
+			for (int t = 0; t < m->nthreads; t++) {
+				memcpy(m->grp + ngrp, m->next + m->base[t],
+				       m->nnext[t] * sizeof(int));
+				ngrp += m->nnext[t];
+			}
+			m->k *= 2;
+			m->ngrp = m->k < len ? ngrp : 0;
+			cut_groups(m);
+		}
+		pthread_barrier_wait(&m->bar);
+	}
+
+	return NULL;
+}
+
+int sa_threads(void)
+{
+	long n = sysconf(_SC_NPROCESSORS_ONLN);
+	return n > 0 ? n : 1;
+}
+
+int *sa_sort_mt(const unsigned char *str, int len, int nthreads)
+{
+	struct mt m = {
+		.str = str,
+		.len = len,
+		.k = 1,
+		.start = PTHREAD_MUTEX_INITIALIZER,
+	};
+
+	if (nthreads <= 0)
+		nthreads = sa_threads();
+	if (len < 2) {
+		int *sa = malloc(len * sizeof(int));
+		if (len == 1)
+			sa[0] = 0;
+		return sa;
+	}
+
+	m.nthreads = nthreads;
+	m.sa = malloc(len * sizeof(int));
+	m.x = malloc(len * sizeof(int));
+	m.key = malloc(len * sizeof(uint64_t));
+	m.aux = malloc(len * sizeof(uint64_t));
+	m.grp = malloc(((size_t)len + 1) * sizeof(int));
+	m.next = malloc(((size_t)len + 1) * sizeof(int));
+	m.cut = malloc((nthreads + 1) * sizeof(int));
+	m.base = malloc((nthreads + 1) * sizeof(int));
+	m.nnext = malloc(nthreads * sizeof(int));
+	assert(m.sa && m.x && m.key && m.aux && m.grp && m.next);
+	assert(m.cut && m.base && m.nnext);
+
+	// bucket by first character, serial but a single counting pass
+	int count[R+1] = { 0 };
+	for (int i = 0; i < len; i++)
+		count[str[i] + 1]++;
+	for (int c = 0; c < R; c++) {
+		if (count[c+1] >= 2) {
+			m.grp[m.ngrp++] = count[c];
+			m.grp[m.ngrp++] = count[c+1];
+		}
+		count[c+1] += count[c];
+	}
+	for (int i = 0; i < len; i++)
+		m.x[i] = count[str[i]];
+	for (int i = 0; i < len; i++)
+		m.sa[count[str[i]]++] = i;
+
+	struct worker *w = malloc(nthreads * sizeof(struct worker));
+	assert(w);
+	pthread_mutex_lock(&m.start);
+	int started = 1;
+	for (; started < nthreads; started++) {
+		w[started].m = &m;
+		w[started].id = started;
+		if (pthread_create(&w[started].tid, NULL, worker_main, &w[started]) != 0)
+			break;
+	}
+	// out of threads: the ones there are split the work, down to this
+	// one alone
+	m.nthreads = started;
+	cut_groups(&m);
+	pthread_barrier_init(&m.bar, NULL, started);
+	pthread_mutex_unlock(&m.start);
+
+	w[0].m = &m;
+	w[0].id = 0;
+	worker_main(&w[0]);
+	for (int t = 1; t < started; t++)
+		pthread_join(w[t].tid, NULL);
+
+	pthread_barrier_destroy(&m.bar);
+	free(w);
+	free(m.nnext);
+	free(m.base);
+	free(m.cut);
+	free(m.next);
+	free(m.grp);
+	free(m.aux);
+	free(m.key);
+	free(m.x);
+
+	return m.sa;
+}
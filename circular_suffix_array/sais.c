@@ -0,0 +1,74 @@
+#include <stdlib.h>
+#include <assert.h>
+#include <limits.h>
+
+#include "sa.h"
+
+/*
+ * SA-IS, induced sorting after Nong, Zhang & Chan, laid out like Yuta
+ * Mori's sais-lite to stay within the output array:
+ *
+ * - suffix types are recomputed by scanning instead of kept in a bitmap
+ * - the reduced string and its suffix array live in the unused part of
+ *   sa, so do the bucket arrays of the deeper levels when they fit
+ * - a negative entry (~j) marks a suffix whose left neighbour must not
+ *   be induced from it in the current pass
+ */
+
+// alphabets this small get malloc'd buckets instead of a slice of sa
+#define MIN_BUCKET 256
+
+#define IDX int
+#define SFX(name) name
+#include "sais_impl.h"
+#undef IDX
+#undef SFX
+
+#define IDX int64_t
+#define SFX(name) name##64
+#include "sais_impl.h"
+#undef IDX
+#undef SFX
+
+void sa_sais_buf(const unsigned char *str, int len, int *sa)
+{
+	if (len == 1)
+		sa[0] = 0;
+	else if (len > 1)
+		sais_main(str, sa, 0, len, R, 1);
+}
+
+int *sa_sais(const unsigned char *str, int len)
+{
+	int *sa = malloc(len * sizeof(int));
+	assert(sa);
+
+	sa_sais_buf(str, len, sa);
+	return sa;
+}
+
+void sa_sais_buf64(const unsigned char *str, int64_t len, int64_t *sa)
+{
+	if (len == 1)
+		sa[0] = 0;
+	else if (len > 1)
+		sais_main64(str, sa, 0, len, R, 1);
+}
+
+int64_t *sa_sais64(const unsigned char *str, int64_t len)
+{
+	int64_t *sa = malloc(len * sizeof(int64_t));
+	assert(sa);
+
+	sa_sais_buf64(str, len, sa);
+	return sa;
+}
+
+// half the memory and better cache use when the input allows it
+void *sa_build(const unsigned char *str, int64_t len, int *wide)
+{
+	*wide = len > INT_MAX;
+	if (*wide)
+		return sa_sais64(str, len);
+	return sa_sais(str, (int)len);
+}
@@ -0,0 +1,352 @@
+/*
+ * SA-IS body templated on the index type, sais.c includes it once per
+ * width with IDX and SFX(name) defined; no include guard on purpose
+ */
+
+// level 0 sorts bytes, the reduced problems sort ints
+#define chr(i) (cs == sizeof(IDX) ? ((const IDX *)t)[i] : ((const unsigned char *)t)[i])
+
+static void SFX(get_counts)(const void *t, IDX *c, IDX n, IDX k, int cs)
+{
+	for (IDX i = 0; i < k; i++)
+		c[i] = 0;
+	for (IDX i = 0; i < n; i++)
+		c[chr(i)]++;
+}
+
+// starts of buckets, or ends if end
+static void SFX(get_buckets)(const IDX *c, IDX *b, IDX k, int end)
+{
+	IDX sum = 0;
+
+	for (IDX i = 0; i < k; i++) {
+		sum += c[i];
+		b[i] = end ? sum : sum - c[i];
+	}
+}
+
+// sort the LMS-substrings, sa holds j for "induce suffix j next"
+static void SFX(lms_sort)(const void *t, IDX *sa, IDX *c, IDX *b, IDX n, IDX k, int cs)
+{
+	IDX *p, i, j, c0, c1;
+
+	// L-type, left to right from the starts of buckets
+	if (c == b)
+		SFX(get_counts)(t, c, n, k, cs);
+	SFX(get_buckets)(c, b, k, 0);
+	j = n - 1;
+	p = sa + b[c1 = chr(j)];
+	--j;
+	*p++ = chr(j) < c1 ? ~j : j;
+	for (i = 0; i < n; i++) {
+		if ((j = sa[i]) > 0) {
+			assert(chr(j) >= chr(j + 1));
+			if ((c0 = chr(j)) != c1) {
+				b[c1] = p - sa;
+				p = sa + b[c1 = c0];
+			}
+			assert(i < p - sa);
+			--j;
+			*p++ = chr(j) < c1 ? ~j : j;
+			sa[i] = 0;
+		} else if (j < 0) {
+			sa[i] = ~j;
+		}
+	}
+
+	// S-type, right to left from the ends of buckets
+	if (c == b)
+		SFX(get_counts)(t, c, n, k, cs);
+	SFX(get_buckets)(c, b, k, 1);
+	for (i = n - 1, p = sa + b[c1 = 0]; i >= 0; i--) {
+		if ((j = sa[i]) > 0) {
+			assert(chr(j) <= chr(j + 1));
+			if ((c0 = chr(j)) != c1) {
+				b[c1] = p - sa;
+				p = sa + b[c1 = c0];
+			}
+			assert(p - sa <= i);
+			--j;
+			// j + 1 is an LMS suffix, keep it marked
+			*--p = chr(j) > c1 ? ~(j + 1) : j;
+			sa[i] = 0;
+		}
+	}
+}
+
+// name the sorted LMS-substrings, returns how many distinct names
+static IDX SFX(lms_postproc)(const void *t, IDX *sa, IDX n, IDX m, int cs)
+{
+	IDX i, j, p, q, plen, qlen, name, c0, c1;
+
+	// move the sorted LMS positions to sa[0, m), 2m <= n
+	for (i = 0; (p = sa[i]) < 0; i++) {
+		sa[i] = ~p;
+		assert(i + 1 < n);
+	}
+	if (i < m) {
+		for (j = i, i++;; i++) {
+			assert(i < n);
+			if ((p = sa[i]) < 0) {
+				sa[j++] = ~p;
+				sa[i] = 0;
+				if (j == m)
+					break;
+			}
+		}
+	}
+
+	// length of every LMS-substring, at m + pos / 2 (LMS are >= 2 apart)
+	i = n - 1;
+	j = n - 1;
+	c0 = chr(n - 1);
+	do {
+		c1 = c0;
+	} while (--i >= 0 && (c0 = chr(i)) >= c1);
+	while (i >= 0) {
+		do {
+			c1 = c0;
+		} while (--i >= 0 && (c0 = chr(i)) <= c1);
+		if (i >= 0) {
+			sa[m + ((i + 1) >> 1)] = j - i;
+			j = i + 1;
+			do {
+				c1 = c0;
+			} while (--i >= 0 && (c0 = chr(i)) >= c1);
+		}
+	}
+
+	// equal neighbours in sorted order share a name, names start at 1
+	for (i = 0, name = 0, q = n, qlen = 0; i < m; i++) {
+		int diff = 1;
+
+		p = sa[i];
+		plen = sa[m + (p >> 1)];
+		if (plen == qlen && q + plen < n) {
+			for (j = 0; j < plen && chr(p + j) == chr(q + j); j++)
+				;
+			if (j == plen)
+				diff = 0;
+		}
+		if (diff) {
+			name++;
+			q = p;
+			qlen = plen;
+		}
+		sa[m + (p >> 1)] = name;
+	}
+
+	return name;
+}
+
+// induce every suffix from the sorted LMS suffixes at the ends of buckets
+static void SFX(induce_sa)(const void *t, IDX *sa, IDX *c, IDX *b, IDX n, IDX k, int cs)
+{
+	IDX *p, i, j, c0, c1;
+
+	if (c == b)
+		SFX(get_counts)(t, c, n, k, cs);
+	SFX(get_buckets)(c, b, k, 0);
+	j = n - 1;
+	p = sa + b[c1 = chr(j)];
+	*p++ = j > 0 && chr(j - 1) < c1 ? ~j : j;
+	for (i = 0; i < n; i++) {
+		j = sa[i];
+		sa[i] = ~j;
+		if (j > 0) {
+			--j;
+			assert(chr(j) >= chr(j + 1));
+			if ((c0 = chr(j)) != c1) {
+				b[c1] = p - sa;
+				p = sa + b[c1 = c0];
+			}
+			assert(i < p - sa);
+			*p++ = j > 0 && chr(j - 1) < c1 ? ~j : j;
+		}
+	}
+
+	if (c == b)
+		SFX(get_counts)(t, c, n, k, cs);
+	SFX(get_buckets)(c, b, k, 1);
+	for (i = n - 1, p = sa + b[c1 = 0]; i >= 0; i--) {
+		if ((j = sa[i]) > 0) {
+			--j;
+			assert(chr(j) <= chr(j + 1));
+			if ((c0 = chr(j)) != c1) {
+				b[c1] = p - sa;
+				p = sa + b[c1 = c0];
+			}
+			assert(p - sa <= i);
+			*--p = j == 0 || chr(j - 1) > c1 ? ~j : j;
+		} else {
+			sa[i] = ~j;
+		}
+	}
+}
+
+// suffix array of t[0, n) over [0, k) into sa, fs free ints after sa[n]
+static void SFX(sais_main)(const void *t, IDX *sa, IDX fs, IDX n, IDX k, int cs)
+{
+	IDX *c, *b, *ra, *p;
+	IDX i, j, m, q, name, newfs, c0, c1, dummy;
+	// 1: c malloc'd, 2: b malloc'd, 4: c == b malloc'd, 8: c recounted
+	unsigned int flags;
+
+	assert(n > 0 && k >= 1 && fs >= 0);
+
+	if (k <= MIN_BUCKET) {
+		c = malloc(k * sizeof(IDX));
+		assert(c);
+		if (k <= fs) {
+			b = sa + (n + fs - k);
+			flags = 1;
+		} else {
+			b = malloc(k * sizeof(IDX));
+			assert(b);
+			flags = 3;
+		}
+	} else if (k <= fs) {
+		c = sa + (n + fs - k);
+		if (k <= fs - k) {
+			b = c - k;
+			flags = 0;
+		} else if (k <= MIN_BUCKET * 4) {
+			b = malloc(k * sizeof(IDX));
+			assert(b);
+			flags = 2;
+		} else {
+			b = c;
+			flags = 8;
+		}
+	} else {
+		c = b = malloc(k * sizeof(IDX));
+		assert(c);
+		flags = 4 | 8;
+	}
+
+	// stage 1: drop every LMS suffix at the end of its bucket and sort
+	// the LMS-substrings, the problem shrinks by at least half
+	SFX(get_counts)(t, c, n, k, cs);
+	SFX(get_buckets)(c, b, k, 1);
+	for (i = 0; i < n; i++)
+		sa[i] = 0;
+	p = &dummy;
+	i = n - 1;
+	j = n;
+	m = 0;
+	c0 = chr(n - 1);
+	do {
+		c1 = c0;
+	} while (--i >= 0 && (c0 = chr(i)) >= c1);
+	while (i >= 0) {
+		do {
+			c1 = c0;
+		} while (--i >= 0 && (c0 = chr(i)) <= c1);
+		if (i >= 0) {
+			// i + 1 is LMS, store the L suffix to its left
+			*p = j;
+			p = sa + --b[c1];
+			j = i;
+			m++;
+			do {
+				c1 = c0;
+			} while (--i >= 0 && (c0 = chr(i)) >= c1);
+		}
+	}
+
+	if (m > 1) {
+		SFX(lms_sort)(t, sa, c, b, n, k, cs);
+		name = SFX(lms_postproc)(t, sa, n, m, cs);
+	} else if (m == 1) {
+		*p = j + 1;
+		name = 1;
+	} else {
+		name = 0;
+	}
+
+	// stage 2: names not unique yet, sort the string of names
+	if (name < m) {
+		if (flags & 4)
+			free(c);
+		if (flags & 2)
+			free(b);
+		newfs = n + fs - m * 2;
+		if (!(flags & (1 | 4 | 8))) {
+			// keep c intact past the reduced problem if it fits
+			if (k + name <= newfs)
+				newfs -= k;
+			else
+				flags |= 8;
+		}
+		assert(n >> 1 <= newfs + m);
+		ra = sa + m + newfs;
+		for (i = m + (n >> 1) - 1, j = m - 1; i >= m; i--) {
+			if (sa[i] != 0)
+				ra[j--] = sa[i] - 1;
+		}
+
+		SFX(sais_main)(ra, sa, newfs, m, name, sizeof(IDX));
+
+		// reduced suffix -> LMS position
+		i = n - 1;
+		j = m - 1;
+		c0 = chr(n - 1);
+		do {
+			c1 = c0;
+		} while (--i >= 0 && (c0 = chr(i)) >= c1);
+		while (i >= 0) {
+			do {
+				c1 = c0;
+			} while (--i >= 0 && (c0 = chr(i)) <= c1);
+			if (i >= 0) {
+				ra[j--] = i + 1;
+				do {
+					c1 = c0;
+				} while (--i >= 0 && (c0 = chr(i)) >= c1);
+			}
+		}
+		for (i = 0; i < m; i++)
+			sa[i] = ra[sa[i]];
+
+		if (flags & 4) {
+			c = b = malloc(k * sizeof(IDX));
+			assert(c);
+		}
+		if (flags & 2) {
+			b = malloc(k * sizeof(IDX));
+			assert(b);
+		}
+	}
+
+	// stage 3: sorted LMS suffixes to the ends of their buckets, induce
+	if (flags & 8)
+		SFX(get_counts)(t, c, n, k, cs);
+	if (m > 1) {
+		SFX(get_buckets)(c, b, k, 1);
+		i = m - 1;
+		j = n;
+		q = sa[m - 1];
+		c1 = chr(q);
+		do {
+			IDX end = b[c0 = c1];
+			while (end < j)
+				sa[--j] = 0;
+			do {
+				sa[--j] = q;
+				if (--i < 0)
+					break;
+				q = sa[i];
+			} while ((c1 = chr(q)) == c0);
+		} while (i >= 0);
+		while (j > 0)
+			sa[--j] = 0;
+	}
+	SFX(induce_sa)(t, sa, c, b, n, k, cs);
+
+	if (flags & (1 | 4))
+		free(c);
+	if (flags & 2)
+		free(b);
+}
+
+#undef chr
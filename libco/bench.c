@@ -0,0 +1,863 @@
+/*
+ * libco benchmarks
+ *
+ * $ gcc -O2 bench.c co.c -o bench -lpthread
+ * $ ./bench [name]
+ *
+ * add -DCO_STATS for the stats bench
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <malloc.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sched.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/resource.h>
+#include "co-test.h"
+
+static long long now_ns()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static size_t heap_used()
+{
+	struct mallinfo2 mi = mallinfo2();
+	return mi.uordblks + mi.hblkhd;
+}
+
+//===============================================================
+// shared stack: memory per co vs. cost per switch
+//===============================================================
+
+#define SHALLOW_CO 1000
+#define SHALLOW_YIELD 1000
+
+static void shallow(void *arg)
+{
+	// a little stack that has to be copied on every switch
+	volatile char frame[256];
+	frame[0] = 0;
+	for (int i = 0; i < SHALLOW_YIELD; i++) {
+		frame[i % sizeof(frame)]++;
+		co_yield();
+	}
+}
+
+static void bench_shared_stack_one(const char *label, unsigned int flags)
+{
+	struct co_attr attr = { .flags = flags };
+	struct co *cos[SHALLOW_CO];
+
+	size_t before = heap_used();
+	for (int i = 0; i < SHALLOW_CO; i++) {
+		cos[i] = co_start_attr("shallow", shallow, NULL, &attr);
+		if (!cos[i]) {
+			fprintf(stderr, "co_start failure\n");
+			exit(1);
+		}
+	}
+
+	// one round so every shared-stack co has a save buffer
+	co_yield();
+	size_t mem = heap_used() - before;
+
+	long long start = now_ns();
+	for (int i = 0; i < SHALLOW_CO; i++)
+		co_wait(cos[i]);
+	long long elapsed = now_ns() - start;
+
+	long long switches = (long long)SHALLOW_CO * SHALLOW_YIELD;
+	printf("%-8s %6d co  %10zu bytes  %8zu bytes/co  %6.1f ns/switch\n",
+			label, SHALLOW_CO, mem, mem / SHALLOW_CO,
+			(double)elapsed / switches);
+}
+
+static void bench_shared_stack()
+{
+	bench_shared_stack_one("private", 0);
+	bench_shared_stack_one("shared", CO_SHARED_STACK);
+}
+
+//===============================================================
+// producer/consumer: polling Queue vs. channel
+//===============================================================
+
+#define PC_ITEMS 1000000
+
+static int pc_running;
+static long pc_spins;
+
+static void poll_producer(void *arg)
+{
+	Queue *queue = arg;
+	static Item items[100];
+	int next = 0;
+
+	for (int i = 0; i < PC_ITEMS; ) {
+		if (!q_is_full(queue)) {
+			Item *item = &items[next++ % 100];
+			q_push(queue, item);
+			i++;
+		} else {
+			pc_spins++;
+		}
+		co_yield();
+	}
+}
+
+static void poll_consumer(void *arg)
+{
+	Queue *queue = arg;
+
+	while (pc_running || !q_is_empty(queue)) {
+		if (!q_is_empty(queue))
+			q_pop(queue);
+		else
+			pc_spins++;
+		co_yield();
+	}
+}
+
+static void chan_producer(void *arg)
+{
+	for (long i = 0; i < PC_ITEMS; i++)
+		co_chan_send(arg, (void *)i);
+}
+
+static void chan_consumer(void *arg)
+{
+	void *data;
+
+	while (co_chan_recv(arg, &data) == 0)
+		;
+}
+
+static void bench_chan()
+{
+	Queue *queue = q_new();
+	pc_running = 1;
+	pc_spins = 0;
+
+	long long start = now_ns();
+	struct co *p = co_start("producer", poll_producer, queue);
+	struct co *c = co_start("consumer", poll_consumer, queue);
+	co_wait(p);
+	pc_running = 0;
+	co_wait(c);
+	long long elapsed = now_ns() - start;
+	printf("queue    %6.1f ns/item  %ld empty polls\n",
+			(double)elapsed / PC_ITEMS, pc_spins);
+	q_free(queue);
+
+	struct co_chan *ch = co_chan_new(100);
+
+	start = now_ns();
+	p = co_start("producer", chan_producer, ch);
+	c = co_start("consumer", chan_consumer, ch);
+	co_wait(p);
+	co_chan_close(ch);
+	co_wait(c);
+	elapsed = now_ns() - start;
+	printf("chan     %6.1f ns/item  0 empty polls\n", (double)elapsed / PC_ITEMS);
+	co_chan_free(ch);
+}
+
+//===============================================================
+// loopback echo server over co_read/co_write
+//===============================================================
+
+#define ECHO_CLIENTS 16
+#define ECHO_ROUNDS 5000
+#define ECHO_MSG 64
+
+static struct sockaddr_in echo_addr;
+
+static void echo_conn(void *arg)
+{
+	int fd = (int)(long)arg;
+	char buf[ECHO_MSG];
+	ssize_t n;
+
+	while ((n = co_read(fd, buf, sizeof(buf))) > 0) {
+		if (co_write(fd, buf, n) != n)
+			break;
+	}
+	co_close(fd);
+}
+
+static void echo_server(void *arg)
+{
+	int lfd = (int)(long)arg;
+	struct co *conns[ECHO_CLIENTS];
+
+	for (int i = 0; i < ECHO_CLIENTS; i++) {
+		int fd = co_accept(lfd, NULL, NULL);
+		if (fd < 0) {
+			perror("accept");
+			exit(1);
+		}
+		conns[i] = co_start("echo-conn", echo_conn, (void *)(long)fd);
+	}
+	for (int i = 0; i < ECHO_CLIENTS; i++)
+		co_wait(conns[i]);
+}
+
+static void echo_client(void *arg)
+{
+	int fd = socket(AF_INET, SOCK_STREAM, 0);
+	int one = 1;
+	char buf[ECHO_MSG];
+
+	setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+	if (co_connect(fd, (struct sockaddr *)&echo_addr, sizeof(echo_addr)) < 0) {
+		perror("connect");
+		exit(1);
+	}
+
+	memset(buf, 'e', sizeof(buf));
+	for (int i = 0; i < ECHO_ROUNDS; i++) {
+		co_write(fd, buf, sizeof(buf));
+		for (size_t got = 0; got < sizeof(buf); ) {
+			ssize_t n = co_read(fd, buf + got, sizeof(buf) - got);
+			if (n <= 0) {
+				perror("read");
+				exit(1);
+			}
+			got += n;
+		}
+	}
+	co_close(fd);
+}
+
+static void bench_echo()
+{
+	int lfd = socket(AF_INET, SOCK_STREAM, 0);
+	socklen_t len = sizeof(echo_addr);
+
+	echo_addr.sin_family = AF_INET;
+	echo_addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	echo_addr.sin_port = 0;
+	if (bind(lfd, (struct sockaddr *)&echo_addr, sizeof(echo_addr)) < 0 ||
+			listen(lfd, ECHO_CLIENTS) < 0 ||
+			getsockname(lfd, (struct sockaddr *)&echo_addr, &len) < 0) {
+		perror("listen");
+		exit(1);
+	}
+
+	struct co *clients[ECHO_CLIENTS];
+	long long start = now_ns();
+	struct co *server = co_start("echo-server", echo_server, (void *)(long)lfd);
+	for (int i = 0; i < ECHO_CLIENTS; i++)
+		clients[i] = co_start("echo-client", echo_client, NULL);
+	for (int i = 0; i < ECHO_CLIENTS; i++)
+		co_wait(clients[i]);
+	co_wait(server);
+	long long elapsed = now_ns() - start;
+	co_close(lfd);
+
+	long long msgs = (long long)ECHO_CLIENTS * ECHO_ROUNDS;
+	printf("%d clients  %lld round trips  %8.0f rt/s  %6.1f us/rt\n",
+			ECHO_CLIENTS, msgs, msgs * 1e9 / elapsed,
+			(double)elapsed / 1000 / ECHO_ROUNDS);
+}
+
+//===============================================================
+// timing wheel: arm/cancel cost with a million pending timers
+//===============================================================
+
+#define TIMERS 1000000
+
+static long timers_fired;
+
+static void count_fired(void *arg)
+{
+	timers_fired++;
+}
+
+static void bench_timers()
+{
+	struct co_timer **timers = malloc(TIMERS * sizeof(struct co_timer *));
+	unsigned int seed = 1;
+
+	for (int i = 0; i < TIMERS; i++)
+		timers[i] = co_timer_new(count_fired, NULL);
+
+	// spread over 1ms..1h so every level is used
+	long long start = now_ns();
+	for (int i = 0; i < TIMERS; i++) {
+		uint64_t ms = 1 + rand_r(&seed) % 3600000;
+		co_timer_arm(timers[i], ms * 1000000ULL);
+	}
+	long long arm = now_ns() - start;
+
+	start = now_ns();
+	for (int i = 0; i < TIMERS; i++)
+		co_timer_cancel(timers[i]);
+	long long cancel = now_ns() - start;
+
+	// all due within 100ms
+	timers_fired = 0;
+	for (int i = 0; i < TIMERS; i++)
+		co_timer_arm(timers[i], (1 + i % 100) * 1000000ULL);
+	start = now_ns();
+	co_sleep(150 * 1000000ULL);
+	long long fire = now_ns() - start;
+
+	printf("arm %5.1f ns  cancel %5.1f ns  fired %ld/%d in %.1f ms\n",
+			(double)arm / TIMERS, (double)cancel / TIMERS,
+			timers_fired, TIMERS, fire / 1e6);
+
+	for (int i = 0; i < TIMERS; i++)
+		co_timer_free(timers[i]);
+	free(timers);
+}
+
+//===============================================================
+// instrumentation: who hogs the thread, build with -DCO_STATS
+//===============================================================
+
+#define STATS_ROUNDS 10000
+
+static void hog(void *arg)
+{
+	volatile unsigned long x = 0;
+	for (int i = 0; i < STATS_ROUNDS / 10; i++) {
+		for (int j = 0; j < 100000; j++)
+			x += j;
+		co_yield();
+	}
+}
+
+static void pinger(void *arg)
+{
+	for (long i = 0; i < STATS_ROUNDS; i++)
+		co_chan_send(arg, (void *)i);
+	co_chan_close(arg);
+}
+
+static void ponger(void *arg)
+{
+	void *data;
+	while (co_chan_recv(arg, &data) == 0)
+		;
+}
+
+static void bench_stats()
+{
+	struct co_chan *ch = co_chan_new(0);
+	struct co *cos[3];
+	struct co_stats st;
+	uint64_t hist[CO_LAT_BUCKETS];
+
+	long long start = now_ns();
+	cos[0] = co_start("hog", hog, NULL);
+	cos[1] = co_start("pinger", pinger, ch);
+	cos[2] = co_start("ponger", ponger, ch);
+
+	// co_wait frees, ask while they are still around
+	while (co_wait_timeout(cos[1], 0) < 0)
+		co_sleep(1000000ULL);
+	co_wait(cos[2]);
+	printf("pinger/ponger done after %.1f ms\n", (now_ns() - start) / 1e6);
+
+	co_get_stats(cos[0], &st);
+	printf("%-8s %8lu switches  %8.1f ms run  %8.1f ms ready\n", "hog",
+			(unsigned long)st.switches, st.run_ns / 1e6, st.ready_ns / 1e6);
+	co_wait(cos[0]);
+
+	co_get_stats(NULL, &st);
+	printf("%-8s %8lu switches  %8.1f ms run  %8.1f ms ready\n", "main",
+			(unsigned long)st.switches, st.run_ns / 1e6, st.ready_ns / 1e6);
+
+	co_latency_histogram(hist);
+	for (int i = 0; i < CO_LAT_BUCKETS; i++) {
+		if (hist[i])
+			printf("  >= %12llu ns  %8lu\n", 1ULL << i, (unsigned long)hist[i]);
+	}
+
+	if (co_trace_dump("co-trace.json") == 0)
+		printf("trace written to co-trace.json\n");
+	co_chan_free(ch);
+}
+
+//===============================================================
+// priority: wakeup latency of a handler behind cpu-bound load
+//===============================================================
+
+#define PRIO_LOAD 32
+#define PRIO_REQS 500
+#define PRIO_LOAD_WORK 20000
+
+static volatile int prio_stop;
+static long long prio_posted;
+static long long prio_lat[PRIO_REQS];
+
+static void prio_load(void *arg)
+{
+	volatile unsigned long x = 0;
+	while (!prio_stop) {
+		for (int j = 0; j < PRIO_LOAD_WORK; j++)
+			x += j;
+		co_yield();
+	}
+}
+
+static void prio_fire(void *arg)
+{
+	prio_posted = now_ns();
+	co_sem_post(arg);
+}
+
+static void prio_handler(void *arg)
+{
+	struct co_sem *sem = co_sem_new(0);
+	struct co_timer *t = co_timer_new(prio_fire, sem);
+
+	for (int i = 0; i < PRIO_REQS; i++) {
+		co_timer_arm(t, 1000000ULL);
+		co_sem_wait(sem);
+		prio_lat[i] = now_ns() - prio_posted;
+	}
+	co_timer_free(t);
+	co_sem_free(sem);
+}
+
+static int cmp_ll(const void *a, const void *b)
+{
+	long long x = *(const long long *)a, y = *(const long long *)b;
+	return (x > y) - (x < y);
+}
+
+static void bench_prio_one(const char *label, int prio)
+{
+	struct co_attr attr = { .prio = prio };
+	struct co *load[PRIO_LOAD];
+
+	prio_stop = 0;
+	for (int i = 0; i < PRIO_LOAD; i++)
+		load[i] = co_start("load", prio_load, NULL);
+	co_wait(co_start_attr("handler", prio_handler, NULL, &attr));
+	prio_stop = 1;
+	for (int i = 0; i < PRIO_LOAD; i++)
+		co_wait(load[i]);
+
+	qsort(prio_lat, PRIO_REQS, sizeof(prio_lat[0]), cmp_ll);
+	printf("%-7s handler  p50 %8.1f us  p99 %8.1f us  max %8.1f us\n", label,
+			prio_lat[PRIO_REQS / 2] / 1e3, prio_lat[PRIO_REQS * 99 / 100] / 1e3,
+			prio_lat[PRIO_REQS - 1] / 1e3);
+}
+
+static void bench_prio()
+{
+	bench_prio_one("high", CO_PRIO_HIGH);
+	bench_prio_one("normal", CO_PRIO_NORMAL);
+}
+
+//===============================================================
+// generators: co_resume()/co_yield_value() vs. a Queue + co_yield()
+//===============================================================
+
+#define PIPE_ITEMS 1000000
+
+static int pipe_done;
+static long pipe_sum;
+
+static void queue_producer(void *arg)
+{
+	Queue *queue = arg;
+	for (long i = 0; i < PIPE_ITEMS; ) {
+		if (!q_is_full(queue)) {
+			Item *item = malloc(sizeof(Item));
+			item->data = (void *)i++;
+			q_push(queue, item);
+		}
+		co_yield();
+	}
+	pipe_done = 1;
+}
+
+static void queue_consumer(void *arg)
+{
+	Queue *queue = arg;
+	while (!pipe_done || !q_is_empty(queue)) {
+		Item *item = q_pop(queue);
+		if (item) {
+			pipe_sum += (long)item->data;
+			free(item);
+		}
+		co_yield();
+	}
+}
+
+static void gen_producer(void *arg)
+{
+	for (long i = 0; i < PIPE_ITEMS; i++)
+		co_yield_value((void *)i);
+}
+
+static void bench_gen()
+{
+	Queue *queue = q_new();
+	pipe_done = 0;
+	pipe_sum = 0;
+
+	long long start = now_ns();
+	struct co *p = co_start("producer", queue_producer, queue);
+	struct co *c = co_start("consumer", queue_consumer, queue);
+	co_wait(p);
+	co_wait(c);
+	long long queued = now_ns() - start;
+	long queued_sum = pipe_sum;
+	q_free(queue);
+
+	struct co_attr attr = { .flags = CO_GENERATOR };
+	void *value;
+	pipe_sum = 0;
+
+	start = now_ns();
+	struct co *gen = co_start_attr("producer", gen_producer, NULL, &attr);
+	while (co_resume(gen, &value) == 0)
+		pipe_sum += (long)value;
+	co_wait(gen);
+	long long generated = now_ns() - start;
+
+	printf("queue      %6.1f ns/item  sum %ld\n", (double)queued / PIPE_ITEMS, queued_sum);
+	printf("generator  %6.1f ns/item  sum %ld\n", (double)generated / PIPE_ITEMS, pipe_sum);
+}
+
+//===============================================================
+// rings: list Queue vs. Spsc/Mpmc, one by one and batched
+//===============================================================
+
+#define RING_OPS 10000000
+#define RING_N 32
+
+static void bench_ring_queue()
+{
+	Queue *queue = q_new();
+	long sum = 0;
+
+	long long start = now_ns();
+	for (long i = 0; i < RING_OPS; i++) {
+		Item *item = malloc(sizeof(Item));
+		item->data = (void *)i;
+		q_push(queue, item);
+		item = q_pop(queue);
+		sum += (long)item->data;
+		free(item);
+	}
+	long long ns = now_ns() - start;
+
+	printf("%-14s %6.1f ns/op  sum %ld\n", "list queue", (double)ns / RING_OPS, sum);
+	q_free(queue);
+}
+
+static void bench_ring_single(const char *label, int mpmc, size_t batch)
+{
+	Spsc *spsc = spsc_new(1024);
+	Mpmc *ring = mpmc_new(1024);
+	void *items[RING_N];
+	long sum = 0;
+
+	long long start = now_ns();
+	for (long i = 0; i < RING_OPS; i += batch) {
+		for (size_t j = 0; j < batch; j++)
+			items[j] = (void *)(i + j);
+		if (mpmc) {
+			mpmc_push_n(ring, items, batch);
+			mpmc_pop_n(ring, items, batch);
+		} else {
+			spsc_push_n(spsc, items, batch);
+			spsc_pop_n(spsc, items, batch);
+		}
+		for (size_t j = 0; j < batch; j++)
+			sum += (long)items[j];
+	}
+	long long ns = now_ns() - start;
+
+	printf("%-14s %6.1f ns/op  sum %ld\n", label, (double)ns / RING_OPS, sum);
+	spsc_free(spsc);
+	mpmc_free(ring);
+}
+
+static Mpmc *xring;
+
+static void *xring_producer(void *arg)
+{
+	size_t batch = (size_t)arg;
+	void *items[RING_N];
+
+	for (long i = 0; i < RING_OPS; ) {
+		size_t n = 0;
+		while (n < batch && i + (long)n < RING_OPS) {
+			items[n] = (void *)(i + n);
+			n++;
+		}
+		n = mpmc_push_n(xring, items, n);
+		// full, one cpu is enough to run this bench
+		if (n == 0)
+			sched_yield();
+		i += n;
+	}
+	return NULL;
+}
+
+// one producer and one consumer thread through an Mpmc
+static void bench_ring_threads(const char *label, size_t batch)
+{
+	void *items[RING_N];
+	pthread_t tid;
+	long sum = 0;
+
+	xring = mpmc_new(1024);
+	long long start = now_ns();
+	pthread_create(&tid, NULL, xring_producer, (void *)batch);
+	for (long seen = 0; seen < RING_OPS; ) {
+		size_t n = mpmc_pop_n(xring, items, batch);
+		if (n == 0)
+			sched_yield();
+		for (size_t j = 0; j < n; j++)
+			sum += (long)items[j];
+		seen += n;
+	}
+	pthread_join(tid, NULL);
+	long long ns = now_ns() - start;
+
+	printf("%-14s %6.1f ns/op  sum %ld\n", label, (double)ns / RING_OPS, sum);
+	mpmc_free(xring);
+}
+
+static void bench_ring()
+{
+	bench_ring_queue();
+	bench_ring_single("spsc", 0, 1);
+	bench_ring_single("spsc x32", 0, RING_N);
+	bench_ring_single("mpmc", 1, 1);
+	bench_ring_single("mpmc x32", 1, RING_N);
+	bench_ring_threads("mpmc 2 thr", 1);
+	bench_ring_threads("mpmc 2 thr x32", RING_N);
+}
+
+//===============================================================
+// offload: blocking calls inline vs. on the offload pool
+//===============================================================
+
+#define OFF_CO 8
+#define OFF_CALLS 10
+#define OFF_NOOPS 20000
+
+static int off_stop;
+static long long off_max_gap;
+
+static void *off_block(void *arg)
+{
+	usleep(1000);
+	return NULL;
+}
+
+static void *off_noop(void *arg)
+{
+	return arg;
+}
+
+static void off_request(void *arg)
+{
+	for (int i = 0; i < OFF_CALLS; i++) {
+		if (arg)
+			co_offload(off_block, NULL);
+		else
+			off_block(NULL);
+	}
+}
+
+// how late a 1ms tick gets while requests run
+static void off_ticker(void *arg)
+{
+	long long last = now_ns();
+	while (!off_stop) {
+		co_sleep(1000000ULL);
+		long long now = now_ns();
+		if (now - last > off_max_gap)
+			off_max_gap = now - last;
+		last = now;
+	}
+}
+
+static void bench_offload_one(const char *label, int offload)
+{
+	struct co *cos[OFF_CO];
+
+	off_stop = 0;
+	off_max_gap = 0;
+	struct co *ticker = co_start("ticker", off_ticker, NULL);
+
+	long long start = now_ns();
+	for (int i = 0; i < OFF_CO; i++)
+		cos[i] = co_start("request", off_request, offload ? (void *)1 : NULL);
+	for (int i = 0; i < OFF_CO; i++)
+		co_wait(cos[i]);
+	double ms = (now_ns() - start) / 1e6;
+
+	off_stop = 1;
+	co_wait(ticker);
+	printf("%-8s %6.1f ms wall  tick gap max %6.1f ms\n", label, ms, off_max_gap / 1e6);
+}
+
+static void bench_offload()
+{
+	bench_offload_one("inline", 0);
+	bench_offload_one("offload", 1);
+
+	long long start = now_ns();
+	for (long i = 0; i < OFF_NOOPS; i++)
+		co_offload(off_noop, (void *)i);
+	printf("round trip %.1f us\n", (now_ns() - start) / 1e3 / OFF_NOOPS);
+}
+
+//===============================================================
+// co-local storage: get/set cost
+//===============================================================
+
+#define LOCAL_OPS 10000000
+
+static void bench_local_co(void *arg)
+{
+	int key = (int)(long)arg;
+	long sum = 0;
+
+	long long start = now_ns();
+	for (long i = 0; i < LOCAL_OPS; i++)
+		co_local_set(key, (void *)i);
+	long long set = now_ns() - start;
+
+	start = now_ns();
+	for (long i = 0; i < LOCAL_OPS; i++)
+		sum += (long)co_local_get(key);
+	long long get = now_ns() - start;
+
+	printf("set %5.1f ns  get %5.1f ns  (%ld)\n",
+			(double)set / LOCAL_OPS, (double)get / LOCAL_OPS, sum);
+}
+
+static void bench_local()
+{
+	int key = co_key_new(NULL);
+	co_wait(co_start("local", bench_local_co, (void *)(long)key));
+	co_key_free(key);
+}
+
+//===============================================================
+// M:N: cpu-bound co spread over 1..nproc threads
+//===============================================================
+
+#define CPU_CO 64
+#define CPU_SLICES 100
+#define CPU_SLICE_WORK 100000
+
+static void cpu_bound(void *arg)
+{
+	volatile unsigned long x = (unsigned long)arg;
+	for (int i = 0; i < CPU_SLICES; i++) {
+		for (int j = 0; j < CPU_SLICE_WORK; j++)
+			x = x * 6364136223846793005UL + 1442695040888963407UL;
+		co_yield();
+	}
+}
+
+static void bench_mn_scaling()
+{
+	long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+	double base = 0;
+
+	for (int want = 1; want <= ncpu * 2; want *= 2) {
+		int nthreads = co_set_threads(want);
+		struct co *cos[CPU_CO];
+
+		long long start = now_ns();
+		for (int i = 0; i < CPU_CO; i++)
+			cos[i] = co_start("cpu", cpu_bound, (void *)(long)i);
+		for (int i = 0; i < CPU_CO; i++)
+			co_wait(cos[i]);
+		double ms = (now_ns() - start) / 1e6;
+
+		if (want == 1)
+			base = ms;
+		printf("%3d threads  %8.1f ms  %5.2fx\n", nthreads, ms, base / ms);
+	}
+}
+
+//===============================================================
+// idle: cpu burnt while every co sleeps
+//===============================================================
+
+static double cpu_ms()
+{
+	struct rusage ru;
+	getrusage(RUSAGE_SELF, &ru);
+	return (ru.ru_utime.tv_sec + ru.ru_stime.tv_sec) * 1e3 +
+		(ru.ru_utime.tv_usec + ru.ru_stime.tv_usec) / 1e3;
+}
+
+static void nap(void *arg)
+{
+	co_sleep(500 * 1000000ULL);
+}
+
+static void bench_idle()
+{
+	struct co *cos[8];
+	int nthreads = co_set_threads(4);
+
+	double cpu = cpu_ms();
+	long long start = now_ns();
+	for (int i = 0; i < 8; i++)
+		cos[i] = co_start("nap", nap, NULL);
+	for (int i = 0; i < 8; i++)
+		co_wait(cos[i]);
+	double wall = (now_ns() - start) / 1e6;
+
+	printf("%d threads  %.1f ms wall  %.1f ms cpu\n", nthreads, wall, cpu_ms() - cpu);
+}
+
+static struct {
+	const char *name;
+	void (*func)();
+} benches[] = {
+	{ "shared-stack", bench_shared_stack },
+	{ "chan", bench_chan },
+	{ "echo", bench_echo },
+	{ "timers", bench_timers },
+	{ "stats", bench_stats },
+	{ "prio", bench_prio },
+	{ "gen", bench_gen },
+	{ "ring", bench_ring },
+	{ "offload", bench_offload },
+	{ "local", bench_local },
+	// add threads for good, keep them last
+	{ "mn-scaling", bench_mn_scaling },
+	{ "idle", bench_idle },
+};
+
+int main(int argc, char *argv[])
+{
+	int n = sizeof(benches) / sizeof(benches[0]);
+
+	for (int i = 0; i < n; i++) {
+		if (argc < 2 || strcmp(argv[1], benches[i].name) == 0) {
+			printf("== %s\n", benches[i].name);
+			benches[i].func();
+		}
+	}
+
+	return 0;
+}
@@ -304,3 +304,213 @@ static inline Item* q_pop(Queue *queue) {
     queue->sz -= 1;
     return item;
 }
+
+//===============================================================
+// bounded rings of void *, no allocation per element
+//===============================================================
+
+#define RING_CACHELINE 64
+
+// one producer, one consumer, each caches the other's index and only
+// rereads it when the ring looks full/empty
+typedef struct Spsc_t {
+    size_t mask;
+    void **slots;
+    size_t head __attribute__((aligned(RING_CACHELINE)));
+    size_t tail_cache;
+    size_t tail __attribute__((aligned(RING_CACHELINE)));
+    size_t head_cache;
+} Spsc;
+
+// any number of producers and consumers, a slot's seq says whose turn it is
+typedef struct RingCell_t {
+    size_t seq;
+    void *data;
+} RingCell;
+
+typedef struct Mpmc_t {
+    size_t mask;
+    RingCell *cells;
+    size_t head __attribute__((aligned(RING_CACHELINE)));
+    size_t tail __attribute__((aligned(RING_CACHELINE)));
+} Mpmc;
+
+// cap is rounded up to a power of 2
+static inline size_t ring_cap(size_t cap) {
+    size_t n = 2;
+    while (n < cap) {
+        n <<= 1;
+    }
+    return n;
+}
+
+static inline Spsc* spsc_new(size_t cap) {
+    Spsc *q = (Spsc*)aligned_alloc(RING_CACHELINE, sizeof(Spsc));
+    if (!q) {
+        fprintf(stderr, "New ring failure\n");
+        exit(1);
+    }
+    memset(q, 0, sizeof(Spsc));
+    q->mask = ring_cap(cap) - 1;
+    q->slots = (void**)calloc(q->mask + 1, sizeof(void*));
+    if (!q->slots) {
+        fprintf(stderr, "New ring failure\n");
+        exit(1);
+    }
+    return q;
+}
+
+static inline void spsc_free(Spsc *q) {
+    free(q->slots);
+    free(q);
+}
+
+// producer side, returns how many of items[0..n) went in
+static inline size_t spsc_push_n(Spsc *q, void **items, size_t n) {
+    size_t tail = q->tail;
+    size_t cap = q->mask + 1;
+
+    if (tail - q->head_cache + n > cap) {
+        q->head_cache = __atomic_load_n(&q->head, __ATOMIC_ACQUIRE);
+    }
+    size_t room = cap - (tail - q->head_cache);
+    if (n > room) {
+        n = room;
+    }
+    for (size_t i = 0; i < n; i++) {
+        q->slots[(tail + i) & q->mask] = items[i];
+    }
+    // one release for the whole batch
+    __atomic_store_n(&q->tail, tail + n, __ATOMIC_RELEASE);
+    return n;
+}
+
+// consumer side, returns how many landed in items[0..n)
+static inline size_t spsc_pop_n(Spsc *q, void **items, size_t n) {
+    size_t head = q->head;
+
+    if (q->tail_cache - head < n) {
+        q->tail_cache = __atomic_load_n(&q->tail, __ATOMIC_ACQUIRE);
+    }
+    size_t avail = q->tail_cache - head;
+    if (n > avail) {
+        n = avail;
+    }
+    for (size_t i = 0; i < n; i++) {
+        items[i] = q->slots[(head + i) & q->mask];
+    }
+    __atomic_store_n(&q->head, head + n, __ATOMIC_RELEASE);
+    return n;
+}
+
+static inline int spsc_push(Spsc *q, void *item) {
+    return spsc_push_n(q, &item, 1) == 1 ? 0 : -1;
+}
+
+static inline int spsc_pop(Spsc *q, void **item) {
+    return spsc_pop_n(q, item, 1) == 1 ? 0 : -1;
+}
+
+static inline Mpmc* mpmc_new(size_t cap) {
+    Mpmc *q = (Mpmc*)aligned_alloc(RING_CACHELINE, sizeof(Mpmc));
+    if (!q) {
+        fprintf(stderr, "New ring failure\n");
+        exit(1);
+    }
+    memset(q, 0, sizeof(Mpmc));
+    q->mask = ring_cap(cap) - 1;
+    q->cells = (RingCell*)malloc((q->mask + 1) * sizeof(RingCell));
+    if (!q->cells) {
+        fprintf(stderr, "New ring failure\n");
+        exit(1);
+    }
+    for (size_t i = 0; i <= q->mask; i++) {
+        q->cells[i].seq = i;
+    }
+    return q;
+}
+
+static inline void mpmc_free(Mpmc *q) {
+    free(q->cells);
+    free(q);
+}
+
+// claims up to n consecutive free cells with one CAS on tail
+static inline size_t mpmc_push_n(Mpmc *q, void **items, size_t n) {
+    size_t pos = __atomic_load_n(&q->tail, __ATOMIC_RELAXED);
+    size_t k;
+
+    for (;;) {
+        // cell pos + k is free once its seq caught up with it
+        for (k = 0; k < n; k++) {
+            RingCell *cell = &q->cells[(pos + k) & q->mask];
+            if (__atomic_load_n(&cell->seq, __ATOMIC_ACQUIRE) != pos + k) {
+                break;
+            }
+        }
+        if (k == 0) {
+            size_t now = __atomic_load_n(&q->tail, __ATOMIC_RELAXED);
+            // full
+            if (now == pos) {
+                return 0;
+            }
+            pos = now;
+            continue;
+        }
+        if (__atomic_compare_exchange_n(&q->tail, &pos, pos + k, 1,
+                                        __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+            break;
+        }
+    }
+
+    for (size_t i = 0; i < k; i++) {
+        RingCell *cell = &q->cells[(pos + i) & q->mask];
+        cell->data = items[i];
+        __atomic_store_n(&cell->seq, pos + i + 1, __ATOMIC_RELEASE);
+    }
+    return k;
+}
+
+// claims up to n consecutive filled cells with one CAS on head
+static inline size_t mpmc_pop_n(Mpmc *q, void **items, size_t n) {
+    size_t pos = __atomic_load_n(&q->head, __ATOMIC_RELAXED);
+    size_t k;
+
+    for (;;) {
+        for (k = 0; k < n; k++) {
+            RingCell *cell = &q->cells[(pos + k) & q->mask];
+            if (__atomic_load_n(&cell->seq, __ATOMIC_ACQUIRE) != pos + k + 1) {
+                break;
+            }
+        }
+        if (k == 0) {
+            size_t now = __atomic_load_n(&q->head, __ATOMIC_RELAXED);
+            // empty
+            if (now == pos) {
+                return 0;
+            }
+            pos = now;
+            continue;
+        }
+        if (__atomic_compare_exchange_n(&q->head, &pos, pos + k, 1,
+                                        __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+            break;
+        }
+    }
+
+    for (size_t i = 0; i < k; i++) {
+        RingCell *cell = &q->cells[(pos + i) & q->mask];
+        items[i] = cell->data;
+        // free for the producer one lap later
+        __atomic_store_n(&cell->seq, pos + i + q->mask + 1, __ATOMIC_RELEASE);
+    }
+    return k;
+}
+
+static inline int mpmc_push(Mpmc *q, void *item) {
+    return mpmc_push_n(q, &item, 1) == 1 ? 0 : -1;
+}
+
+static inline int mpmc_pop(Mpmc *q, void **item) {
+    return mpmc_pop_n(q, item, 1) == 1 ? 0 : -1;
+}
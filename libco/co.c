@@ -1,17 +1,98 @@
+#define _GNU_SOURCE
 #include "co.h"
 #include <stdlib.h>
 #include <setjmp.h>
 #include <stdint.h>
+#include <limits.h>
 #include <assert.h>
 #include <string.h>
+#include <pthread.h>
+#include <sched.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include <stdio.h>
+#include <time.h>
 
-/* non thread-safe */
+/*
+ * M:N, every thread that touches libco owns a struct sched with its own
+ * run queue, idle threads steal from the others.
+ *
+ * A co is only published (pushed to a run queue, or made visible to a
+ * waker by unlocking) after its context has been saved, see
+ * finish_switch(), so no two threads ever run on the same stack.
+ */
 
 // 64KB, align 16byte
 #define STACK_SIZE 64 * 1024 + 0x10
 
-// 128 maximum co
-#define CO_MAX 128
+// smallest co_attr.stack_size taken as is
+#define STACK_MIN 4 * 1024
+
+// fill pattern of an unused stack
+#define STACK_PAINT 'A'
+
+// shared by all CO_SHARED_STACK co of a thread, only the used part is copied out
+#define SHARED_STACK_SIZE 256 * 1024 + 0x10
+
+// restore a shared-stack co from here, never from the shared stack itself
+#define SCRATCH_STACK_SIZE 16 * 1024
+
+// maximum threads running co
+#define SCHED_MAX 64
+
+// maximum threads running co_offload() jobs
+#define OFFLOAD_MAX 16
+
+// destructor passes at exit, a destructor may set values again
+#define LOCAL_DTOR_PASSES 4
+
+#define PRIO_LEVELS (CO_PRIO_LOW - CO_PRIO_HIGH + 1)
+#define PRIO_IDX(prio) ((prio) - CO_PRIO_HIGH)
+
+// a runnable level passed over this many picks in a row runs next
+#define STARVE_LIMIT 8
+
+// x86_64 leaf code may touch 128 bytes below %rsp
+#if __x86_64__
+#define RED_ZONE 128
+#else
+#define RED_ZONE 0
+#endif
+
+// fs-relative access, a co may resume on another thread
+#define CO_TLS __thread __attribute__((tls_model("initial-exec")))
+
+typedef struct {
+	int locked;
+} spinlock_t;
+
+static inline void cpu_relax()
+{
+#if __x86_64__ || __i386__
+	__builtin_ia32_pause();
+#endif
+}
+
+static inline void spin_lock(spinlock_t *lock)
+{
+	while (__atomic_exchange_n(&lock->locked, 1, __ATOMIC_ACQUIRE)) {
+		while (__atomic_load_n(&lock->locked, __ATOMIC_RELAXED))
+			cpu_relax();
+	}
+}
+
+static inline void spin_unlock(spinlock_t *lock)
+{
+	__atomic_store_n(&lock->locked, 0, __ATOMIC_RELEASE);
+}
 
 enum co_status {
 	CO_NEW = 1,
@@ -28,9 +109,115 @@ struct co {
 	enum co_status status;
 	struct co *waiter;
 	jmp_buf context;
-	uint8_t stack[STACK_SIZE];
+	uint8_t *stack;
+	size_t stack_size;
+
+	// stack pointer at the last schedule out
+	void *sp;
+	// saved [sp, top) of a shared-stack co
+	void *save_buf;
+	size_t save_size;
+	size_t save_cap;
+	// deepest save_size so far
+	size_t save_max;
+
+	// protects status == CO_DEAD, waiter and sleep
+	spinlock_t lock;
+	// never stolen, always resumed by home
+	int pinned;
+	// co_attr.prio, zero is CO_PRIO_NORMAL
+	int prio;
+	// sched it last ran on
+	struct sched *home;
+	// run queue or wait queue link
+	struct co *next;
+
+	// handed over by whoever wakes a parked co
+	void *wait_data;
+	int wait_ok;
+	// what a CO_WAITING co is blocked in
+	const char *wait_on;
+
+	// all_co list
+	struct co *all_prev;
+	struct co *all_next;
+
+	// co_group it was spawned in, its live list
+	struct co_group *group;
+	struct co *sib_prev;
+	struct co *sib_next;
+	// leaves at its next yield point
+	int cancelled;
+	// armed co_sleep() timer, protected by lock
+	struct co_timer *sleep;
+	// co_sleep()/co_wait_timeout() timer, allocated on first use. Not
+	// on the stack: a shared one is overwritten while the co is parked
+	struct co_timer *timer;
+
+	// co-local values, CO_KEYS_MAX, allocated on the first co_local_set()
+	struct local_slot *local;
+
+#ifdef CO_STATS
+	uint64_t switches;
+	uint64_t run_ns;
+	uint64_t ready_ns;
+	// when it became runnable / started running, 0 if not
+	uint64_t ready_at;
+	uint64_t run_at;
+#endif
+};
+
+struct co_queue {
+	struct co *head;
+	struct co *tail;
+};
+
+// value is stale unless seq matches its key's
+struct local_slot {
+	unsigned int seq;
+	void *value;
+};
+
+// what the co we switched away from wants done once it is off its stack
+enum switch_action {
+	SWITCH_NONE = 0,
+	SWITCH_YIELD,
+	SWITCH_PARK,
+	SWITCH_EXIT,
+	// park, then co_ready() s->handoff
+	SWITCH_HANDOFF,
+};
 
-	int list_idx;
+struct sched {
+	int id;
+
+	spinlock_t lock;
+	// one per priority, highest first
+	struct co_queue runq[PRIO_LEVELS];
+	// picks a runnable level has been passed over
+	int skipped[PRIO_LEVELS];
+	int nready;
+	// not pinned, may be stolen
+	int nsteal;
+
+	// runs when nothing is runnable, never queued
+	struct co *idle;
+
+	struct co *prev;
+	enum switch_action action;
+	spinlock_t *unlock;
+	struct co *handoff;
+
+	uint8_t *shared_stack;
+	// co whose frames currently live on shared_stack
+	struct co *shared_owner;
+	uint8_t *scratch_stack;
+
+	// idle, futex word, co_ready() has to wake it
+	int parked;
+	// blocked in epoll_wait(), co_ready() has to kick it
+	int polling;
+	unsigned int tick;
 };
 
 // special co for main()
@@ -40,102 +227,580 @@ struct co main_co = {
 	.arg = NULL,
 	.status = CO_RUNNING,
 	.waiter = NULL,
-	.list_idx = 0,
+	.pinned = 1,
 };
 
 // current co
-static struct co *current = &main_co;
-// all co
-static struct co *co_list[CO_MAX] = { &main_co, NULL };
+static CO_TLS struct co *current;
+// sched of this thread
+static CO_TLS struct sched *this_sched;
 
-struct co *co_start(const char *name, void (*func)(void *), void *arg)
+// all sched
+static struct sched *sched_list[SCHED_MAX];
+static int nsched;
+static pthread_mutex_t sched_mutex = PTHREAD_MUTEX_INITIALIZER;
+// sched with nothing to do
+static int nidle;
+// abort once nothing libco knows of can wake anyone, see co_set_deadlock_check()
+static int deadlock_check;
+
+// every co but the idle ones, for the deadlock report
+static struct co *all_co;
+static spinlock_t all_lock;
+
+// co parked on an fd, the only wake source besides timers and co
+static int nfd_waiters;
+// co parked in co_offload()
+static int noffload;
+
+static void co_wrapper(void *arg);
+static void co_exit();
+static void sched_loop(void *arg);
+static int reactor_poll(int timeout);
+static void reactor_kick();
+static void reactor_init();
+static void offload_complete();
+static void group_exit(struct co *co);
+static void local_destroy(struct co *co);
+static void timer_expedite(struct co_timer *t);
+static void timer_poll();
+static int timer_timeout();
+static int timer_pending();
+
+// epoll fd, -1 until the first co_read()/co_write()/...
+static int epfd = -1;
+// when a thread sleeping in epoll_wait() wakes up by itself, 0 if none,
+// earlier timers have to kick it
+static uint64_t poll_deadline;
+
+static inline uint64_t clock_ns()
 {
-	static int idx = 0;
-	int i = (idx + 1) % CO_MAX;
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
 
-	for (; i != idx; i = (i + 1) % CO_MAX) {
-		if (co_list[i] == NULL) {
-			break;
-		}
-	}
+static void all_co_add(struct co *co)
+{
+	spin_lock(&all_lock);
+	co->all_prev = NULL;
+	co->all_next = all_co;
+	if (all_co)
+		all_co->all_prev = co;
+	all_co = co;
+	spin_unlock(&all_lock);
+}
 
-	if (i == idx && co_list[idx] != NULL)
-		return NULL;
+static void all_co_del(struct co *co)
+{
+	spin_lock(&all_lock);
+	if (co->all_prev)
+		co->all_prev->all_next = co->all_next;
+	else
+		all_co = co->all_next;
+	if (co->all_next)
+		co->all_next->all_prev = co->all_prev;
+	spin_unlock(&all_lock);
+}
 
-	idx = i;
+static inline void queue_push(struct co_queue *q, struct co *co)
+{
+	co->next = NULL;
+	if (q->tail)
+		q->tail->next = co;
+	else
+		q->head = co;
+	q->tail = co;
+}
+
+static inline struct co *queue_pop(struct co_queue *q)
+{
+	struct co *co = q->head;
+	if (co) {
+		q->head = co->next;
+		if (!q->head)
+			q->tail = NULL;
+		co->next = NULL;
+	}
+	return co;
+}
 
-	struct co *new = malloc(sizeof(struct co));
+// stack_size == 0: no private stack
+static struct co *co_alloc(const char *name, void (*func)(void *), void *arg, size_t stack_size)
+{
+	// private stack lives right behind struct co
+	struct co *new = malloc(sizeof(struct co) + stack_size);
 	if (!new) {
 		return NULL;
 	}
 
+	memset(new, 0, sizeof(struct co));
 	new->name = name;
 	new->func = func;
 	new->arg = arg;
 
 	new->status = CO_NEW;
-	new->waiter = NULL;
-	memset(new->stack, 'A', STACK_SIZE);
-	new->list_idx = i;
-
-	co_list[i] = new;
+	if (stack_size) {
+		new->stack = (uint8_t *)(new + 1);
+		new->stack_size = stack_size;
+		// read back by co_stack_usage()
+		memset(new->stack, STACK_PAINT, stack_size);
+	}
 
 	return new;
 }
 
-void co_wait(struct co *co)
+// register the calling thread, idle is the co to fall back to
+static struct sched *sched_new(struct co *idle)
 {
-	assert(co->waiter == NULL);
+	struct sched *s = calloc(1, sizeof(struct sched));
+	assert(s);
 
-	// waiting for co exiting
-	if (co->status != CO_DEAD) {
-		current->status = CO_WAITING;
-		co->waiter = current;
+	idle->pinned = 1;
+	idle->home = s;
+	s->idle = idle;
+
+	pthread_mutex_lock(&sched_mutex);
+	assert(nsched < SCHED_MAX);
+	s->id = nsched;
+	sched_list[nsched] = s;
+	__atomic_store_n(&nsched, nsched + 1, __ATOMIC_RELEASE);
+	pthread_mutex_unlock(&sched_mutex);
+
+	this_sched = s;
+	return s;
+}
+
+// lazily turn a plain thread (main() or any other) into a sched
+static struct sched *sched_self()
+{
+	if (this_sched)
+		return this_sched;
 
-		co_yield();
+	struct co *self = &main_co;
+	struct sched *none = NULL;
+	if (!__atomic_compare_exchange_n(&main_co.home, &none, (struct sched *)-1, 0,
+			__ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+		// main_co is taken, a foreign thread gets its own native co
+		self = calloc(1, sizeof(struct co));
+		assert(self);
+		self->name = "native";
+		self->func = (void *)-1;
+		self->status = CO_RUNNING;
 	}
 
-	// schedule in
-	// co is dead
-	assert(co->status == CO_DEAD);
+	// idle loop needs its own stack, the native one belongs to self
+	struct co *idle = co_alloc("idle", sched_loop, NULL, STACK_SIZE);
+	assert(idle);
 
-	co_list[co->list_idx] = NULL;
-	free(co);
+	struct sched *s = sched_new(idle);
+	self->pinned = 1;
+	self->home = s;
+	all_co_add(self);
+	current = self;
+	return s;
 }
 
-void co_wrapper(void *arg)
+static inline int is_shared(struct co *co)
 {
-	struct co *run = arg;
+	return co->stack && co->stack == co->home->shared_stack;
+}
 
-	run->status = CO_RUNNING;
-	run->func(run->arg);
-	run->status = CO_DEAD;
+static inline void *stack_top(struct co *co)
+{
+	// align 16bytes
+	return (void *)((uintptr_t)(co->stack + co->stack_size) & (~0xf));
+}
+
+//===============================================================
+// instrumentation, compiled out unless CO_STATS
+//===============================================================
+
+#ifdef CO_STATS
+
+// power of 2 entries
+#define TRACE_SIZE (1 << 16)
+
+struct trace_event {
+	const char *name;
+	uint64_t ts;
+	uint64_t dur;
+	int tid;
+};
+
+static uint64_t lat_hist[CO_LAT_BUCKETS];
+static struct trace_event trace_ring[TRACE_SIZE];
+static uint64_t trace_head;
 
-	if (run->waiter) {
-		run->waiter->status = CO_RUNNING;
+static inline void stats_ready(struct co *co)
+{
+	co->ready_at = clock_ns();
+}
+
+// current is about to give the cpu to next
+static inline void stats_switch(struct sched *s, struct co *next)
+{
+	uint64_t now = clock_ns();
+	struct co *prev = current;
+
+	if (prev->run_at) {
+		uint64_t dur = now - prev->run_at;
+		prev->run_ns += dur;
+		prev->run_at = 0;
+
+		uint64_t i = __atomic_fetch_add(&trace_head, 1, __ATOMIC_RELAXED);
+		struct trace_event *ev = &trace_ring[i & (TRACE_SIZE - 1)];
+		ev->name = prev->name;
+		ev->ts = now - dur;
+		ev->dur = dur;
+		ev->tid = s->id;
 	}
 
-	// schedule out & never return
-	co_yield();
+	if (next->ready_at) {
+		uint64_t wait = now - next->ready_at;
+		int b = wait ? 63 - __builtin_clzll(wait) : 0;
+		next->ready_ns += wait;
+		next->ready_at = 0;
+		__atomic_fetch_add(&lat_hist[b < CO_LAT_BUCKETS ? b : CO_LAT_BUCKETS - 1],
+				1, __ATOMIC_RELAXED);
+	}
 
-	assert(1);
+	next->switches++;
+	next->run_at = now;
 }
 
-// pick next co
-// status == CO_NEW or CO_RUNNING
-struct co *co_next()
+#else
+
+static inline void stats_ready(struct co *co)
+{
+}
+
+static inline void stats_switch(struct sched *s, struct co *next)
+{
+}
+
+#endif
+
+void co_get_stats(struct co *co, struct co_stats *st)
+{
+	memset(st, 0, sizeof(struct co_stats));
+#ifdef CO_STATS
+	if (!co) {
+		sched_self();
+		co = current;
+	}
+	st->switches = co->switches;
+	st->run_ns = co->run_ns;
+	// still running
+	if (co == current && co->run_at)
+		st->run_ns += clock_ns() - co->run_at;
+	st->ready_ns = co->ready_ns;
+#endif
+}
+
+void co_latency_histogram(uint64_t hist[CO_LAT_BUCKETS])
+{
+	for (int i = 0; i < CO_LAT_BUCKETS; i++) {
+#ifdef CO_STATS
+		hist[i] = __atomic_load_n(&lat_hist[i], __ATOMIC_RELAXED);
+#else
+		hist[i] = 0;
+#endif
+	}
+}
+
+int co_trace_dump(const char *path)
+{
+	FILE *fp = fopen(path, "w");
+	if (!fp)
+		return -1;
+
+	fprintf(fp, "{\"traceEvents\":[");
+#ifdef CO_STATS
+	uint64_t head = __atomic_load_n(&trace_head, __ATOMIC_ACQUIRE);
+	uint64_t first = head > TRACE_SIZE ? head - TRACE_SIZE : 0;
+	for (uint64_t i = first; i < head; i++) {
+		struct trace_event *ev = &trace_ring[i & (TRACE_SIZE - 1)];
+
+		fprintf(fp, "%s\n{\"name\":\"", i == first ? "" : ",");
+		for (const char *c = ev->name ? ev->name : "?"; *c; c++) {
+			if (*c == '"' || *c == '\\')
+				fputc('\\', fp);
+			if ((unsigned char)*c >= 0x20)
+				fputc(*c, fp);
+		}
+		fprintf(fp, "\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f}",
+				ev->tid, ev->ts / 1e3, ev->dur / 1e3);
+	}
+#endif
+	fprintf(fp, "\n]}\n");
+
+	return fclose(fp) == 0 ? 0 : -1;
+}
+
+static inline long futex(int *uaddr, int op, int val)
+{
+	return syscall(SYS_futex, uaddr, op, val, NULL, NULL, 0);
+}
+
+// get an idle sched going again
+static void sched_wake(struct sched *s)
+{
+	if (!__atomic_exchange_n(&s->parked, 0, __ATOMIC_SEQ_CST))
+		return;
+
+	if (__atomic_load_n(&s->polling, __ATOMIC_SEQ_CST))
+		reactor_kick();
+	else
+		futex(&s->parked, FUTEX_WAKE_PRIVATE, 1);
+}
+
+// let some idle sched steal from busy
+static void sched_wake_one(struct sched *busy)
+{
+	int n = __atomic_load_n(&nsched, __ATOMIC_ACQUIRE);
+
+	for (int i = 1; i < n; i++) {
+		struct sched *s = sched_list[(busy->id + i) % n];
+		if (__atomic_load_n(&s->parked, __ATOMIC_RELAXED)) {
+			sched_wake(s);
+			return;
+		}
+	}
+}
+
+// make co runnable, any thread
+static void co_ready(struct co *co)
+{
+	struct sched *s = co->pinned || !this_sched ? co->home : this_sched;
+
+	if (co->status != CO_NEW)
+		co->status = CO_RUNNING;
+	stats_ready(co);
+
+	spin_lock(&s->lock);
+	queue_push(&s->runq[PRIO_IDX(co->prio)], co);
+	s->nready++;
+	if (!co->pinned)
+		s->nsteal++;
+	spin_unlock(&s->lock);
+
+	// pairs with the fence in sched_idle()
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	if (__atomic_load_n(&s->parked, __ATOMIC_RELAXED))
+		sched_wake(s);
+	else if (!co->pinned && __atomic_load_n(&nidle, __ATOMIC_RELAXED))
+		sched_wake_one(s);
+}
+
+struct co *co_start(const char *name, void (*func)(void *), void *arg)
+{
+	return co_start_attr(name, func, arg, NULL);
+}
+
+// a co that is not runnable yet
+static struct co *co_create(const char *name, void (*func)(void *), void *arg,
+		const struct co_attr *attr)
+{
+	int shared = attr && (attr->flags & CO_SHARED_STACK);
+	size_t stack_size = attr && attr->stack_size ? attr->stack_size : STACK_SIZE;
+	struct sched *s = sched_self();
+
+	int prio = attr ? attr->prio : CO_PRIO_NORMAL;
+
+	if (stack_size < STACK_MIN)
+		stack_size = STACK_MIN;
+	if (prio < CO_PRIO_HIGH)
+		prio = CO_PRIO_HIGH;
+	if (prio > CO_PRIO_LOW)
+		prio = CO_PRIO_LOW;
+	// align 16bytes
+	stack_size = (stack_size + 0xf) & ~(size_t)0xf;
+
+	struct co *new = co_alloc(name, func, arg, shared ? 0 : stack_size);
+	if (!new) {
+		return NULL;
+	}
+
+	new->home = s;
+	new->prio = prio;
+	if (shared) {
+		// saved frames point into this thread's shared stack
+		if (!s->shared_stack) {
+			s->shared_stack = malloc(SHARED_STACK_SIZE);
+			s->scratch_stack = malloc(SCRATCH_STACK_SIZE);
+			assert(s->shared_stack && s->scratch_stack);
+		}
+		new->stack = s->shared_stack;
+		new->stack_size = SHARED_STACK_SIZE;
+		new->pinned = 1;
+	}
+
+	all_co_add(new);
+
+	return new;
+}
+
+struct co *co_start_attr(const char *name, void (*func)(void *), void *arg,
+		const struct co_attr *attr)
+{
+	struct co *new = co_create(name, func, arg, attr);
+
+	// a generator first runs in co_resume()
+	if (new && !(attr && (attr->flags & CO_GENERATOR)))
+		co_ready(new);
+
+	return new;
+}
+
+// move up to half of a victim's stealable co to s
+static struct co *steal(struct sched *s)
+{
+	int n = __atomic_load_n(&nsched, __ATOMIC_ACQUIRE);
+
+	for (int i = 1; i < n; i++) {
+		struct sched *victim = sched_list[(s->id + i) % n];
+		if (__atomic_load_n(&victim->nsteal, __ATOMIC_RELAXED) == 0)
+			continue;
+
+		struct co_queue got = { NULL, NULL };
+		int ngot = 0;
+
+		spin_lock(&victim->lock);
+		int want = (victim->nsteal + 1) / 2;
+		struct co *co;
+		// highest priority first
+		for (int l = 0; l < PRIO_LEVELS && ngot < want; l++) {
+			struct co_queue keep = { NULL, NULL };
+			while ((co = queue_pop(&victim->runq[l]))) {
+				if (ngot < want && !co->pinned) {
+					queue_push(&got, co);
+					ngot++;
+				} else {
+					queue_push(&keep, co);
+				}
+			}
+			victim->runq[l] = keep;
+		}
+		victim->nready -= ngot;
+		victim->nsteal -= ngot;
+		spin_unlock(&victim->lock);
+
+		if (ngot == 0)
+			continue;
+
+		struct co *first = queue_pop(&got);
+		if (ngot > 1) {
+			spin_lock(&s->lock);
+			while ((co = queue_pop(&got))) {
+				queue_push(&s->runq[PRIO_IDX(co->prio)], co);
+				s->nready++;
+				s->nsteal++;
+			}
+			spin_unlock(&s->lock);
+		}
+		return first;
+	}
+
+	return NULL;
+}
+
+// highest runnable level, unless a lower one has starved, s->lock held
+static struct co *runq_pop(struct sched *s)
 {
-	static int idx = 0;
-	for (int i = (idx + 1) % CO_MAX; i != idx; i = (i + 1) % CO_MAX) {
-		if (!co_list[i])
+	int pick = -1;
+
+	for (int l = 0; l < PRIO_LEVELS; l++) {
+		if (!s->runq[l].head)
 			continue;
-		if (co_list[i]->status == CO_NEW || co_list[i]->status == CO_RUNNING) {
-			idx = i;
-			return co_list[i];
+		if (pick < 0) {
+			pick = l;
+		} else if (s->skipped[l] >= STARVE_LIMIT) {
+			pick = l;
+			break;
+		}
+	}
+
+	if (pick < 0)
+		return NULL;
+
+	for (int l = pick + 1; l < PRIO_LEVELS; l++) {
+		if (s->runq[l].head)
+			s->skipped[l]++;
+	}
+	s->skipped[pick] = 0;
+
+	return queue_pop(&s->runq[pick]);
+}
+
+// pick next co
+// status == CO_NEW or CO_RUNNING, NULL if there is none
+static struct co *co_next(struct sched *s)
+{
+	struct co *co = NULL;
+
+	if (__atomic_load_n(&s->nready, __ATOMIC_RELAXED)) {
+		spin_lock(&s->lock);
+		co = runq_pop(s);
+		if (co) {
+			s->nready--;
+			if (!co->pinned)
+				s->nsteal--;
 		}
+		spin_unlock(&s->lock);
 	}
 
-	return current;
+	if (!co)
+		co = steal(s);
+
+	return co;
+}
+
+// run the action left by the co we just switched away from
+static void finish_switch()
+{
+	struct sched *s = this_sched;
+	struct co *prev = s->prev;
+	struct co *waiter;
+
+	s->prev = NULL;
+	if (!prev)
+		return;
+
+	switch (s->action) {
+	case SWITCH_YIELD:
+		co_ready(prev);
+		break;
+	case SWITCH_PARK:
+		if (s->unlock)
+			spin_unlock(s->unlock);
+		break;
+	case SWITCH_EXIT:
+		if (s->shared_owner == prev)
+			s->shared_owner = NULL;
+
+		spin_lock(&prev->lock);
+		prev->status = CO_DEAD;
+		// claimed, a co_wait_timeout() timer firing now leaves it alone
+		waiter = prev->waiter;
+		prev->waiter = NULL;
+		spin_unlock(&prev->lock);
+
+		// only its group frees a group child, after this
+		if (prev->group)
+			group_exit(prev);
+
+		// prev may be freed from here on
+		if (waiter)
+			co_ready(waiter);
+		break;
+	case SWITCH_HANDOFF:
+		co_ready(s->handoff);
+		s->handoff = NULL;
+		break;
+	default:
+		break;
+	}
 }
 
 static inline void stack_switch_call(void *sp, void *entry, uintptr_t arg)
@@ -152,28 +817,1954 @@ static inline void stack_switch_call(void *sp, void *entry, uintptr_t arg)
 			);
 }
 
-void co_yield()
+static inline void *stack_pointer()
+{
+	void *sp;
+	asm volatile (
+#if __x86_64__
+			"movq %%rsp, %0"
+#else
+			"movl %%esp, %0"
+#endif
+			: "=r"(sp));
+	return sp;
+}
+
+// copy the live frames of a switched out co off the shared stack
+static void shared_stack_save(struct co *co)
+{
+	uint8_t *sp = (uint8_t *)co->sp - RED_ZONE;
+	size_t size = (uint8_t *)stack_top(co) - sp;
+
+	assert(sp >= co->stack);
+	if (size > co->save_cap) {
+		void *buf = realloc(co->save_buf, size);
+		assert(buf);
+		co->save_buf = buf;
+		co->save_cap = size;
+	}
+	memcpy(co->save_buf, sp, size);
+	co->save_size = size;
+	if (size > co->save_max)
+		co->save_max = size;
+}
+
+// runs on scratch_stack: the frames being restored may overlap ours
+static void shared_stack_restore(void *arg)
+{
+	struct co *co = arg;
+
+	memcpy((uint8_t *)stack_top(co) - co->save_size, co->save_buf, co->save_size);
+	co->home->shared_owner = co;
+	longjmp(co->context, 1);
+}
+
+// switch from current to next, s->prev/action must be set
+static void co_switch(struct co *next)
 {
-	int ret = setjmp(current->context);
-	if (ret == 0) {
-		// schedule out
-		struct co *next = co_next();
+	if (setjmp(current->context) != 0) {
+		// schedule in, maybe on another thread
+		finish_switch();
+		return;
+	}
+
+	// schedule out
+	struct sched *s = this_sched;
+	current->sp = stack_pointer();
 
-		assert(next->status == CO_NEW || next->status == CO_RUNNING);
-		current = next;
-		if (next->status == CO_RUNNING) {
-			longjmp(current->context, 1);
-		} else {
-			// align 16bytes
-			void *stack = (void *)((long)(current->stack + STACK_SIZE) & (~0xf));
-			assert(stack <= (void *)current->stack + STACK_SIZE);
-			stack_switch_call(stack, co_wrapper, (uintptr_t)current);
+	assert(next->status == CO_NEW || next->status == CO_RUNNING);
+	assert(!next->pinned || next->home == s);
+	next->home = s;
+	stats_switch(s, next);
 
-			// should never return
-			assert(1);
+	if (is_shared(next) && s->shared_owner != next) {
+		struct co *owner = s->shared_owner;
+		// a co on its way out has nothing worth saving
+		if (owner && !(owner == s->prev && s->action == SWITCH_EXIT))
+			shared_stack_save(owner);
+		s->shared_owner = NULL;
+	}
+
+	current = next;
+	if (next->status == CO_RUNNING) {
+		if (is_shared(next) && s->shared_owner != next) {
+			void *stack = s->scratch_stack + SCRATCH_STACK_SIZE;
+			stack_switch_call(stack, shared_stack_restore, (uintptr_t)next);
 		}
+		longjmp(next->context, 1);
 	} else {
-		// schedule in
-		return;
+		void *stack = stack_top(next);
+		assert(stack <= (void *)next->stack + next->stack_size);
+		if (is_shared(next))
+			s->shared_owner = next;
+		stack_switch_call(stack, co_wrapper, (uintptr_t)next);
+
+		// should never return
+		assert(1);
+	}
+}
+
+// give up the cpu, action says what happens to current afterwards
+static void schedule(enum switch_action action, spinlock_t *unlock)
+{
+	struct sched *s = sched_self();
+
+	// firing a timer or fd event may need the lock we are parking with,
+	// the next schedule or the idle loop picks them up instead
+	if (!unlock) {
+		timer_poll();
+		// busy threads still pick up I/O now and then
+		if (__atomic_load_n(&epfd, __ATOMIC_RELAXED) >= 0 && (++s->tick & 63) == 0)
+			reactor_poll(0);
+	}
+
+	struct co *next = co_next(s);
+
+	if (!next) {
+		// nothing else to run
+		if (action == SWITCH_YIELD)
+			return;
+		next = s->idle;
+	}
+
+	s->prev = current;
+	s->action = action;
+	s->unlock = unlock;
+	co_switch(next);
+}
+
+// block current until someone co_ready()s it, unlock is released once
+// current is off its stack so wakers holding it never see a live stack
+static void co_park(spinlock_t *unlock, const char *wait_on)
+{
+	current->status = CO_WAITING;
+	current->wait_on = wait_on;
+	schedule(SWITCH_PARK, unlock);
+}
+
+// park current and run next right now, skipping the run queues
+// next must be parked or new with nobody else about to wake it
+static void co_handoff(struct co *next, const char *wait_on)
+{
+	struct sched *s = sched_self();
+
+	current->status = CO_WAITING;
+	current->wait_on = wait_on;
+
+	// only its home may run it, and not before we are off our stack
+	if (next->pinned && next->home != s) {
+		s->handoff = next;
+		schedule(SWITCH_HANDOFF, NULL);
+		return;
+	}
+
+	if (next->status != CO_NEW)
+		next->status = CO_RUNNING;
+	stats_ready(next);
+
+	s->prev = current;
+	s->action = SWITCH_PARK;
+	s->unlock = NULL;
+	co_switch(next);
+}
+
+// anything but a running co that may still call co_ready()
+static int wake_sources()
+{
+	return __atomic_load_n(&nfd_waiters, __ATOMIC_SEQ_CST) > 0 ||
+		__atomic_load_n(&noffload, __ATOMIC_SEQ_CST) > 0 || timer_pending();
+}
+
+static int any_ready(int stealable)
+{
+	int n = __atomic_load_n(&nsched, __ATOMIC_ACQUIRE);
+
+	for (int i = 0; i < n; i++) {
+		struct sched *s = sched_list[i];
+		if (__atomic_load_n(stealable ? &s->nsteal : &s->nready, __ATOMIC_SEQ_CST))
+			return 1;
+	}
+	return 0;
+}
+
+// every thread is idle and nothing can wake anyone up
+static void deadlock_report()
+{
+	fprintf(stderr, "libco: all co are asleep - deadlock!\n");
+
+	spin_lock(&all_lock);
+	for (struct co *co = all_co; co; co = co->all_next) {
+		if (co->status == CO_WAITING)
+			fprintf(stderr, "  %s: %s\n", co->name, co->wait_on ? co->wait_on : "?");
+	}
+	spin_unlock(&all_lock);
+
+	abort();
+}
+
+// sleep until co_ready() wakes us, in epoll_wait() if no other thread is
+static void sched_idle(struct sched *s)
+{
+	// a co_ready() after this sees parked, one before it is seen below
+	__atomic_store_n(&s->parked, 1, __ATOMIC_SEQ_CST);
+	if (__atomic_load_n(&s->nready, __ATOMIC_SEQ_CST) || any_ready(1)) {
+		__atomic_store_n(&s->parked, 0, __ATOMIC_RELAXED);
+		return;
+	}
+
+	int idle = __atomic_add_fetch(&nidle, 1, __ATOMIC_SEQ_CST);
+	if (__atomic_load_n(&deadlock_check, __ATOMIC_RELAXED) &&
+			idle == __atomic_load_n(&nsched, __ATOMIC_ACQUIRE) &&
+			!wake_sources() && !any_ready(0))
+		deadlock_report();
+
+	int polled = -1;
+	if (__atomic_load_n(&epfd, __ATOMIC_ACQUIRE) >= 0) {
+		__atomic_store_n(&s->polling, 1, __ATOMIC_SEQ_CST);
+		if (__atomic_load_n(&s->parked, __ATOMIC_SEQ_CST))
+			polled = reactor_poll(-1);
+		__atomic_store_n(&s->polling, 0, __ATOMIC_SEQ_CST);
+	}
+
+	// somebody else is polling
+	if (polled < 0) {
+		while (__atomic_load_n(&s->parked, __ATOMIC_ACQUIRE))
+			futex(&s->parked, FUTEX_WAIT_PRIVATE, 1);
+	}
+
+	__atomic_store_n(&s->parked, 0, __ATOMIC_RELAXED);
+	__atomic_sub_fetch(&nidle, 1, __ATOMIC_SEQ_CST);
+}
+
+// runs whenever a thread has nothing to do
+static void sched_loop(void *arg)
+{
+	for (;;) {
+		struct sched *s = this_sched;
+
+		// expired timers make their co runnable first
+		timer_poll();
+
+		struct co *next = co_next(s);
+		if (!next) {
+			sched_idle(s);
+			continue;
+		}
+
+		s->prev = current;
+		s->action = SWITCH_NONE;
+		co_switch(next);
+	}
+}
+
+//===============================================================
+// stack usage
+//===============================================================
+
+static struct {
+	uint64_t count;
+	uint64_t max;
+	uint64_t total;
+	uint64_t hist[CO_STACK_BUCKETS];
+} stack_stats;
+
+size_t co_stack_usage(struct co *co)
+{
+	if (!co) {
+		sched_self();
+		co = current;
+	}
+
+	// main() and workers run on their thread's own stack
+	if (!co->stack)
+		return 0;
+
+	// only what was live at some switch, not a true high-water mark
+	if (is_shared(co))
+		return co->save_max;
+
+	// first byte that lost its paint from the bottom, a word at a time
+	const uint8_t *p = co->stack;
+	const uint8_t *end = co->stack + co->stack_size;
+	uint64_t paint;
+	memset(&paint, STACK_PAINT, sizeof(paint));
+
+	while (p + sizeof(paint) <= end && *(const uint64_t *)p == paint)
+		p += sizeof(paint);
+	while (p < end && *p == STACK_PAINT)
+		p++;
+
+	return end - p;
+}
+
+static void stack_stats_add(size_t used)
+{
+	int b = used ? 63 - __builtin_clzll(used) : 0;
+	uint64_t max = __atomic_load_n(&stack_stats.max, __ATOMIC_RELAXED);
+
+	__atomic_fetch_add(&stack_stats.count, 1, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&stack_stats.total, used, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&stack_stats.hist[b < CO_STACK_BUCKETS ? b : CO_STACK_BUCKETS - 1],
+			1, __ATOMIC_RELAXED);
+	while (used > max && !__atomic_compare_exchange_n(&stack_stats.max, &max, used,
+				1, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+		;
+}
+
+void co_get_stack_stats(struct co_stack_stats *st)
+{
+	st->count = __atomic_load_n(&stack_stats.count, __ATOMIC_RELAXED);
+	st->max = __atomic_load_n(&stack_stats.max, __ATOMIC_RELAXED);
+	st->total = __atomic_load_n(&stack_stats.total, __ATOMIC_RELAXED);
+	for (int i = 0; i < CO_STACK_BUCKETS; i++)
+		st->hist[i] = __atomic_load_n(&stack_stats.hist[i], __ATOMIC_RELAXED);
+}
+
+// from co_wait(), co is dead
+static void co_free(struct co *co)
+{
+	stack_stats_add(co_stack_usage(co));
+	all_co_del(co);
+	free(co->save_buf);
+	free(co->local);
+	free(co->timer);
+	free(co);
+}
+
+static void co_wrapper(void *arg)
+{
+	struct co *run = arg;
+
+	finish_switch();
+
+	run->status = CO_RUNNING;
+	run->func(run->arg);
+
+	co_exit();
+}
+
+// after func returns, the stack goes when it is reaped
+static void co_exit()
+{
+	// still on our stack, destructors may use co calls
+	local_destroy(current);
+
+	// schedule out & never return
+	schedule(SWITCH_EXIT, NULL);
+
+	assert(1);
+}
+
+void co_wait(struct co *co)
+{
+	sched_self();
+
+	spin_lock(&co->lock);
+	assert(co->waiter == NULL);
+
+	// waiting for co exiting
+	if (co->status != CO_DEAD) {
+		co->waiter = current;
+		co_park(&co->lock, "co_wait");
+	} else {
+		spin_unlock(&co->lock);
+	}
+
+	// schedule in
+	// co is dead
+	assert(co->status == CO_DEAD);
+
+	co_free(co);
+}
+
+int co_yield()
+{
+	sched_self();
+	// still yield, a child that ignores the cancel must not hog the thread
+	schedule(SWITCH_YIELD, NULL);
+	return __atomic_load_n(&current->cancelled, __ATOMIC_ACQUIRE) ? -1 : 0;
+}
+
+int co_resume(struct co *co, void **value)
+{
+	sched_self();
+
+	// co is parked in co_yield_value() or not started, nobody else looks
+	assert(co->status != CO_DEAD);
+	assert(co->waiter == NULL);
+	co->waiter = current;
+	co->wait_data = value ? *value : NULL;
+	current->wait_ok = 0;
+
+	co_handoff(co, "co_resume");
+
+	// set by co_yield_value(), co exiting leaves it 0
+	if (!current->wait_ok)
+		return -1;
+	if (value)
+		*value = current->wait_data;
+	return 0;
+}
+
+void *co_yield_value(void *value)
+{
+	sched_self();
+
+	struct co *resumer = current->waiter;
+	assert(resumer);
+	current->waiter = NULL;
+	resumer->wait_data = value;
+	resumer->wait_ok = 1;
+
+	co_handoff(resumer, "co_yield_value");
+
+	return current->wait_data;
+}
+
+void co_gen_close(struct co *co)
+{
+	sched_self();
+
+	// co_cancelled() tells it to return, keep resuming until it has
+	__atomic_store_n(&co->cancelled, 1, __ATOMIC_SEQ_CST);
+	while (co->status != CO_DEAD && co_resume(co, NULL) == 0)
+		;
+	co_wait(co);
+}
+
+static void *worker(void *arg)
+{
+	struct co *native = calloc(1, sizeof(struct co));
+	assert(native);
+	native->name = "worker";
+	native->func = (void *)-1;
+	native->status = CO_RUNNING;
+
+	sched_new(native);
+	current = native;
+
+	sched_loop(NULL);
+
+	return NULL;
+}
+
+int co_set_threads(int nthreads)
+{
+	sched_self();
+
+	while (__atomic_load_n(&nsched, __ATOMIC_ACQUIRE) < nthreads) {
+		pthread_t tid;
+		int n = nsched;
+
+		if (pthread_create(&tid, NULL, worker, NULL) != 0)
+			break;
+		pthread_detach(tid);
+
+		// wait for it to register
+		while (__atomic_load_n(&nsched, __ATOMIC_ACQUIRE) == n)
+			sched_yield();
+	}
+
+	return __atomic_load_n(&nsched, __ATOMIC_ACQUIRE);
+}
+
+void co_set_deadlock_check(int on)
+{
+	__atomic_store_n(&deadlock_check, !!on, __ATOMIC_RELAXED);
+}
+
+//===============================================================
+// channels
+//===============================================================
+
+struct co_chan {
+	spinlock_t lock;
+	// 0: rendezvous, CO_CHAN_UNBOUNDED: grows on demand
+	int cap;
+	int closed;
+
+	// ring buffer
+	void **buf;
+	int size;
+	int head;
+	int count;
+
+	// parked co, wait_data is the value to send / the slot to fill
+	struct co_queue sendq;
+	struct co_queue recvq;
+};
+
+struct co_chan *co_chan_new(int cap)
+{
+	assert(cap >= 0 || cap == CO_CHAN_UNBOUNDED);
+
+	struct co_chan *ch = calloc(1, sizeof(struct co_chan));
+	if (!ch)
+		return NULL;
+
+	ch->cap = cap;
+	ch->size = cap == CO_CHAN_UNBOUNDED ? 16 : cap;
+	if (ch->size) {
+		ch->buf = malloc(ch->size * sizeof(void *));
+		if (!ch->buf) {
+			free(ch);
+			return NULL;
+		}
+	}
+
+	return ch;
+}
+
+void co_chan_free(struct co_chan *ch)
+{
+	assert(!ch->sendq.head && !ch->recvq.head);
+	free(ch->buf);
+	free(ch);
+}
+
+static int chan_grow(struct co_chan *ch)
+{
+	int size = ch->size * 2;
+	void **buf = malloc(size * sizeof(void *));
+	if (!buf)
+		return -1;
+
+	for (int i = 0; i < ch->count; i++)
+		buf[i] = ch->buf[(ch->head + i) % ch->size];
+
+	free(ch->buf);
+	ch->buf = buf;
+	ch->size = size;
+	ch->head = 0;
+	return 0;
+}
+
+static inline void chan_put(struct co_chan *ch, void *data)
+{
+	ch->buf[(ch->head + ch->count) % ch->size] = data;
+	ch->count++;
+}
+
+static inline void *chan_take(struct co_chan *ch)
+{
+	void *data = ch->buf[ch->head];
+	ch->head = (ch->head + 1) % ch->size;
+	ch->count--;
+	return data;
+}
+
+int co_chan_send(struct co_chan *ch, void *data)
+{
+	struct co *co;
+
+	sched_self();
+	spin_lock(&ch->lock);
+
+	if (ch->closed) {
+		spin_unlock(&ch->lock);
+		return -1;
+	}
+
+	// a receiver is parked, so the buffer is empty: hand it over
+	if ((co = queue_pop(&ch->recvq))) {
+		spin_unlock(&ch->lock);
+		co->wait_data = data;
+		co->wait_ok = 1;
+		co_ready(co);
+		return 0;
+	}
+
+	if (ch->count == ch->size && ch->cap == CO_CHAN_UNBOUNDED && chan_grow(ch) < 0) {
+		spin_unlock(&ch->lock);
+		return -1;
+	}
+
+	if (ch->count < ch->size) {
+		chan_put(ch, data);
+		spin_unlock(&ch->lock);
+		return 0;
+	}
+
+	// full, the receiver that makes room takes data from us
+	current->wait_data = data;
+	current->wait_ok = 0;
+	queue_push(&ch->sendq, current);
+	co_park(&ch->lock, "co_chan_send");
+
+	return current->wait_ok ? 0 : -1;
+}
+
+int co_chan_recv(struct co_chan *ch, void **data)
+{
+	struct co *co;
+
+	sched_self();
+	spin_lock(&ch->lock);
+
+	if (ch->count) {
+		*data = chan_take(ch);
+		// refill the slot from a parked sender
+		if ((co = queue_pop(&ch->sendq)))
+			chan_put(ch, co->wait_data);
+		spin_unlock(&ch->lock);
+
+		if (co) {
+			co->wait_ok = 1;
+			co_ready(co);
+		}
+		return 0;
+	}
+
+	// rendezvous
+	if ((co = queue_pop(&ch->sendq))) {
+		spin_unlock(&ch->lock);
+		*data = co->wait_data;
+		co->wait_ok = 1;
+		co_ready(co);
+		return 0;
+	}
+
+	if (ch->closed) {
+		spin_unlock(&ch->lock);
+		return -1;
+	}
+
+	current->wait_ok = 0;
+	queue_push(&ch->recvq, current);
+	co_park(&ch->lock, "co_chan_recv");
+
+	if (!current->wait_ok)
+		return -1;
+	*data = current->wait_data;
+	return 0;
+}
+
+void co_chan_close(struct co_chan *ch)
+{
+	struct co_queue wake = { NULL, NULL };
+	struct co *co;
+
+	spin_lock(&ch->lock);
+	ch->closed = 1;
+	while ((co = queue_pop(&ch->recvq)))
+		queue_push(&wake, co);
+	while ((co = queue_pop(&ch->sendq)))
+		queue_push(&wake, co);
+	spin_unlock(&ch->lock);
+
+	// wait_ok stays 0
+	while ((co = queue_pop(&wake)))
+		co_ready(co);
+}
+
+//===============================================================
+// mutex, condition variable, semaphore, wait group
+//===============================================================
+
+struct co_mutex {
+	spinlock_t lock;
+	struct co *owner;
+	struct co_queue waitq;
+};
+
+struct co_cond {
+	spinlock_t lock;
+	struct co_queue waitq;
+};
+
+struct co_sem {
+	spinlock_t lock;
+	int count;
+	struct co_queue waitq;
+};
+
+struct co_wg {
+	spinlock_t lock;
+	int count;
+	struct co_queue waitq;
+};
+
+struct co_mutex *co_mutex_new()
+{
+	return calloc(1, sizeof(struct co_mutex));
+}
+
+void co_mutex_free(struct co_mutex *m)
+{
+	assert(!m->owner && !m->waitq.head);
+	free(m);
+}
+
+void co_mutex_lock(struct co_mutex *m)
+{
+	sched_self();
+	spin_lock(&m->lock);
+
+	if (!m->owner) {
+		m->owner = current;
+		spin_unlock(&m->lock);
+		return;
+	}
+
+	assert(m->owner != current);
+	queue_push(&m->waitq, current);
+	co_park(&m->lock, "co_mutex_lock");
+
+	// ownership was handed over by co_mutex_unlock()
+	assert(m->owner == current);
+}
+
+int co_mutex_trylock(struct co_mutex *m)
+{
+	int ret = -1;
+
+	sched_self();
+	spin_lock(&m->lock);
+	if (!m->owner) {
+		m->owner = current;
+		ret = 0;
+	}
+	spin_unlock(&m->lock);
+
+	return ret;
+}
+
+void co_mutex_unlock(struct co_mutex *m)
+{
+	spin_lock(&m->lock);
+	assert(m->owner == current);
+
+	// hand off directly, nobody can barge in between
+	struct co *next = queue_pop(&m->waitq);
+	m->owner = next;
+	spin_unlock(&m->lock);
+
+	if (next)
+		co_ready(next);
+}
+
+struct co_cond *co_cond_new()
+{
+	return calloc(1, sizeof(struct co_cond));
+}
+
+void co_cond_free(struct co_cond *c)
+{
+	assert(!c->waitq.head);
+	free(c);
+}
+
+void co_cond_wait(struct co_cond *c, struct co_mutex *m)
+{
+	spin_lock(&c->lock);
+	queue_push(&c->waitq, current);
+	// c->lock is held, a signal cannot slip in before we park
+	co_mutex_unlock(m);
+	co_park(&c->lock, "co_cond_wait");
+
+	co_mutex_lock(m);
+}
+
+void co_cond_signal(struct co_cond *c)
+{
+	spin_lock(&c->lock);
+	struct co *co = queue_pop(&c->waitq);
+	spin_unlock(&c->lock);
+
+	if (co)
+		co_ready(co);
+}
+
+void co_cond_broadcast(struct co_cond *c)
+{
+	spin_lock(&c->lock);
+	struct co_queue wake = c->waitq;
+	c->waitq.head = c->waitq.tail = NULL;
+	spin_unlock(&c->lock);
+
+	struct co *co;
+	while ((co = queue_pop(&wake)))
+		co_ready(co);
+}
+
+struct co_sem *co_sem_new(int count)
+{
+	struct co_sem *sem = calloc(1, sizeof(struct co_sem));
+	if (sem)
+		sem->count = count;
+	return sem;
+}
+
+void co_sem_free(struct co_sem *sem)
+{
+	assert(!sem->waitq.head);
+	free(sem);
+}
+
+void co_sem_wait(struct co_sem *sem)
+{
+	sched_self();
+	spin_lock(&sem->lock);
+
+	if (sem->count > 0) {
+		sem->count--;
+		spin_unlock(&sem->lock);
+		return;
+	}
+
+	queue_push(&sem->waitq, current);
+	co_park(&sem->lock, "co_sem_wait");
+}
+
+void co_sem_post(struct co_sem *sem)
+{
+	spin_lock(&sem->lock);
+
+	// the unit goes straight to a waiter, count stays as is
+	struct co *co = queue_pop(&sem->waitq);
+	if (!co)
+		sem->count++;
+	spin_unlock(&sem->lock);
+
+	if (co)
+		co_ready(co);
+}
+
+struct co_wg *co_wg_new()
+{
+	return calloc(1, sizeof(struct co_wg));
+}
+
+void co_wg_free(struct co_wg *wg)
+{
+	assert(!wg->waitq.head);
+	free(wg);
+}
+
+void co_wg_add(struct co_wg *wg, int n)
+{
+	struct co_queue wake = { NULL, NULL };
+
+	spin_lock(&wg->lock);
+	wg->count += n;
+	assert(wg->count >= 0);
+	if (wg->count == 0) {
+		wake = wg->waitq;
+		wg->waitq.head = wg->waitq.tail = NULL;
+	}
+	spin_unlock(&wg->lock);
+
+	struct co *co;
+	while ((co = queue_pop(&wake)))
+		co_ready(co);
+}
+
+void co_wg_done(struct co_wg *wg)
+{
+	co_wg_add(wg, -1);
+}
+
+void co_wg_wait(struct co_wg *wg)
+{
+	sched_self();
+	spin_lock(&wg->lock);
+
+	if (wg->count == 0) {
+		spin_unlock(&wg->lock);
+		return;
+	}
+
+	queue_push(&wg->waitq, current);
+	co_park(&wg->lock, "co_wg_wait");
+}
+
+//===============================================================
+// epoll reactor
+//===============================================================
+
+enum {
+	FD_READ = 0,
+	FD_WRITE,
+};
+
+// registered once, edge-triggered for both directions
+struct co_fd {
+	spinlock_t lock;
+	int registered;
+	// parked co per direction
+	struct co *waiter[2];
+	// an edge arrived while nobody was parked
+	int ready[2];
+	// epoll refused it (regular files), read/write never park
+	int plain;
+};
+
+static struct co_fd **fd_table;
+static int fd_table_size;
+// kicks the poller out of epoll_wait()
+static int evfd = -1;
+// only one thread sits in epoll_wait()
+static spinlock_t poll_lock;
+static pthread_once_t reactor_once = PTHREAD_ONCE_INIT;
+
+static void reactor_init()
+{
+	struct rlimit rl;
+
+	fd_table_size = 65536;
+	if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur != RLIM_INFINITY &&
+			rl.rlim_cur < (1 << 20))
+		fd_table_size = rl.rlim_cur;
+	fd_table = calloc(fd_table_size, sizeof(struct co_fd *));
+	assert(fd_table);
+
+	int fd = epoll_create1(EPOLL_CLOEXEC);
+	assert(fd >= 0);
+
+	evfd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	assert(evfd >= 0);
+	struct epoll_event ev = { .events = EPOLLIN, .data.ptr = NULL };
+	epoll_ctl(fd, EPOLL_CTL_ADD, evfd, &ev);
+
+	__atomic_store_n(&epfd, fd, __ATOMIC_RELEASE);
+}
+
+static void reactor_kick()
+{
+	uint64_t one = 1;
+	ssize_t ret = write(evfd, &one, sizeof(one));
+	(void)ret;
+}
+
+static struct co_fd *fd_get(int fd)
+{
+	pthread_once(&reactor_once, reactor_init);
+
+	if (fd < 0 || fd >= fd_table_size) {
+		errno = EBADF;
+		return NULL;
+	}
+
+	struct co_fd *pd = __atomic_load_n(&fd_table[fd], __ATOMIC_ACQUIRE);
+	if (!pd) {
+		struct co_fd *new = calloc(1, sizeof(struct co_fd));
+		if (!new)
+			return NULL;
+		if (__atomic_compare_exchange_n(&fd_table[fd], &pd, new, 0,
+				__ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+			pd = new;
+		else
+			free(new);
+	}
+
+	if (__atomic_load_n(&pd->registered, __ATOMIC_ACQUIRE))
+		return pd;
+
+	spin_lock(&pd->lock);
+	if (!pd->registered) {
+		int flags = fcntl(fd, F_GETFL);
+		if (flags < 0 || (!(flags & O_NONBLOCK) && fcntl(fd, F_SETFL, flags | O_NONBLOCK) < 0)) {
+			spin_unlock(&pd->lock);
+			return NULL;
+		}
+
+		struct epoll_event ev = {
+			.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET,
+			.data.ptr = pd,
+		};
+		pd->plain = 0;
+		if (epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+			if (errno == EPERM) {
+				// always ready as far as poll is concerned, never park
+				pd->plain = 1;
+			} else if (errno != EEXIST) {
+				spin_unlock(&pd->lock);
+				return NULL;
+			}
+		}
+		pd->ready[FD_READ] = pd->ready[FD_WRITE] = 1;
+		__atomic_store_n(&pd->registered, 1, __ATOMIC_RELEASE);
+	}
+	spin_unlock(&pd->lock);
+
+	return pd;
+}
+
+// park current until fd may be ready for dir
+static void fd_wait(struct co_fd *pd, int dir)
+{
+	spin_lock(&pd->lock);
+	if (pd->ready[dir]) {
+		pd->ready[dir] = 0;
+		spin_unlock(&pd->lock);
+		return;
+	}
+
+	assert(pd->waiter[dir] == NULL);
+	pd->waiter[dir] = current;
+	__atomic_add_fetch(&nfd_waiters, 1, __ATOMIC_SEQ_CST);
+	co_park(&pd->lock, dir == FD_READ ? "fd read" : "fd write");
+	__atomic_sub_fetch(&nfd_waiters, 1, __ATOMIC_SEQ_CST);
+}
+
+// returns how many co were woken, -1 if another thread is polling
+// timeout < 0 sleeps until the next timer
+static int reactor_poll(int timeout)
+{
+	struct epoll_event events[64];
+	int woken = 0;
+
+	if (__atomic_exchange_n(&poll_lock.locked, 1, __ATOMIC_ACQUIRE))
+		return -1;
+
+	if (timeout < 0) {
+		// timers armed from here on kick us, see timer_arm()
+		__atomic_store_n(&poll_deadline, UINT64_MAX, __ATOMIC_SEQ_CST);
+		timeout = timer_timeout();
+	}
+
+	int n = epoll_wait(epfd, events, 64, timeout);
+	__atomic_store_n(&poll_deadline, 0, __ATOMIC_RELAXED);
+	spin_unlock(&poll_lock);
+
+	for (int i = 0; i < n; i++) {
+		struct co_fd *pd = events[i].data.ptr;
+		uint32_t ev = events[i].events;
+		struct co *wake[2] = { NULL, NULL };
+
+		if (!pd) {
+			uint64_t val;
+			ssize_t ret = read(evfd, &val, sizeof(val));
+			(void)ret;
+			// offload threads kick too, after pushing to offload_done
+			offload_complete();
+			continue;
+		}
+
+		spin_lock(&pd->lock);
+		for (int dir = FD_READ; dir <= FD_WRITE; dir++) {
+			uint32_t mask = dir == FD_READ ? EPOLLIN | EPOLLRDHUP : EPOLLOUT;
+			if (!(ev & (mask | EPOLLERR | EPOLLHUP)))
+				continue;
+			wake[dir] = pd->waiter[dir];
+			pd->waiter[dir] = NULL;
+			if (!wake[dir])
+				pd->ready[dir] = 1;
+		}
+		spin_unlock(&pd->lock);
+
+		for (int dir = FD_READ; dir <= FD_WRITE; dir++) {
+			if (wake[dir]) {
+				co_ready(wake[dir]);
+				woken++;
+			}
+		}
+	}
+
+	return woken;
+}
+
+ssize_t co_read(int fd, void *buf, size_t count)
+{
+	struct co_fd *pd = fd_get(fd);
+	if (!pd)
+		return -1;
+
+	if (pd->plain)
+		return read(fd, buf, count);
+
+	for (;;) {
+		ssize_t ret = read(fd, buf, count);
+		if (ret >= 0 || (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR))
+			return ret;
+		if (errno != EINTR)
+			fd_wait(pd, FD_READ);
+	}
+}
+
+ssize_t co_write(int fd, const void *buf, size_t count)
+{
+	struct co_fd *pd = fd_get(fd);
+	if (!pd)
+		return -1;
+
+	if (pd->plain)
+		return write(fd, buf, count);
+
+	for (;;) {
+		ssize_t ret = write(fd, buf, count);
+		if (ret >= 0 || (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR))
+			return ret;
+		if (errno != EINTR)
+			fd_wait(pd, FD_WRITE);
+	}
+}
+
+int co_accept(int fd, struct sockaddr *addr, socklen_t *addrlen)
+{
+	struct co_fd *pd = fd_get(fd);
+	if (!pd)
+		return -1;
+
+	for (;;) {
+		int ret = accept4(fd, addr, addrlen, SOCK_NONBLOCK | SOCK_CLOEXEC);
+		if (ret >= 0 || (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR))
+			return ret;
+		if (errno != EINTR)
+			fd_wait(pd, FD_READ);
+	}
+}
+
+int co_connect(int fd, const struct sockaddr *addr, socklen_t addrlen)
+{
+	struct co_fd *pd = fd_get(fd);
+	if (!pd)
+		return -1;
+
+	// the ready flag set at registration says nothing about the handshake
+	spin_lock(&pd->lock);
+	pd->ready[FD_WRITE] = 0;
+	spin_unlock(&pd->lock);
+
+	if (connect(fd, addr, addrlen) == 0)
+		return 0;
+	if (errno != EINPROGRESS)
+		return -1;
+
+	// writable once the handshake is done, either way; an edge queued
+	// before connect() may still wake us, so ask the socket itself
+	for (;;) {
+		fd_wait(pd, FD_WRITE);
+		struct pollfd p = { .fd = fd, .events = POLLOUT };
+		if (poll(&p, 1, 0) > 0)
+			break;
+	}
+
+	int err = 0;
+	socklen_t len = sizeof(err);
+	if (getsockopt(fd, SOL_SOCKET, SO_ERROR, &err, &len) < 0)
+		return -1;
+	if (err) {
+		errno = err;
+		return -1;
+	}
+	return 0;
+}
+
+int co_close(int fd)
+{
+	if (epfd >= 0 && fd >= 0 && fd < fd_table_size) {
+		struct co_fd *pd = __atomic_load_n(&fd_table[fd], __ATOMIC_ACQUIRE);
+		if (pd) {
+			// the fd number may be reused, start over next time
+			spin_lock(&pd->lock);
+			assert(!pd->waiter[FD_READ] && !pd->waiter[FD_WRITE]);
+			epoll_ctl(epfd, EPOLL_CTL_DEL, fd, NULL);
+			pd->registered = 0;
+			pd->plain = 0;
+			pd->ready[FD_READ] = pd->ready[FD_WRITE] = 0;
+			spin_unlock(&pd->lock);
+		}
+	}
+
+	return close(fd);
+}
+
+//===============================================================
+// timers, hierarchical timing wheel
+//===============================================================
+
+// 1ms
+#define TIMER_TICK_NS 1000000ULL
+// 6 levels of 64 slots cover 2^36 ticks, ~2 years
+#define WHEEL_BITS 6
+#define WHEEL_SIZE (1 << WHEEL_BITS)
+#define WHEEL_MASK (WHEEL_SIZE - 1)
+#define WHEEL_LEVELS 6
+
+enum timer_state {
+	TIMER_IDLE = 0,
+	TIMER_PENDING,
+	TIMER_FIRING,
+};
+
+struct co_timer {
+	// slot list
+	struct co_timer *prev;
+	struct co_timer *next;
+	// absolute tick
+	uint64_t expires;
+	enum timer_state state;
+
+	// called with no lock held, must not block
+	void (*fire)(struct co_timer *t);
+	void (*func)(void *);
+	void *arg;
+
+	// co_sleep()/co_wait_timeout()
+	struct co *co;
+	spinlock_t lock;
+	int fired;
+};
+
+static struct {
+	spinlock_t lock;
+	// next tick to run
+	uint64_t now;
+	long count;
+	// list heads
+	struct co_timer slot[WHEEL_LEVELS][WHEEL_SIZE];
+} wheel;
+
+static pthread_once_t timer_once = PTHREAD_ONCE_INIT;
+
+// the timer whose fire() runs on this thread, so that its func can
+// re-arm, cancel or free it instead of waiting for itself to return
+static CO_TLS struct {
+	struct co_timer *t;
+	// re-armed by func, the wheel owns it again
+	int rearmed;
+	// freed by func, free it once fire() returns
+	int freed;
+} firing;
+
+static void timer_init()
+{
+	for (int l = 0; l < WHEEL_LEVELS; l++) {
+		for (int i = 0; i < WHEEL_SIZE; i++) {
+			wheel.slot[l][i].prev = &wheel.slot[l][i];
+			wheel.slot[l][i].next = &wheel.slot[l][i];
+		}
+	}
+	wheel.now = clock_ns() / TIMER_TICK_NS;
+
+	// idle threads sleep in epoll_wait() until the next timer
+	pthread_once(&reactor_once, reactor_init);
+}
+
+static inline void timer_link(struct co_timer *t, struct co_timer *head)
+{
+	t->prev = head->prev;
+	t->next = head;
+	head->prev->next = t;
+	head->prev = t;
+}
+
+static inline void timer_unlink(struct co_timer *t)
+{
+	t->prev->next = t->next;
+	t->next->prev = t->prev;
+	t->prev = t->next = NULL;
+}
+
+// wheel.lock held
+static void wheel_insert(struct co_timer *t)
+{
+	uint64_t expires = t->expires < wheel.now ? wheel.now : t->expires;
+	uint64_t delta = expires - wheel.now;
+	int level = 0;
+
+	while (level < WHEEL_LEVELS - 1 && delta >> (WHEEL_BITS * (level + 1)))
+		level++;
+	// beyond the top level, park at its far end and cascade again later
+	if (delta >> (WHEEL_BITS * WHEEL_LEVELS))
+		expires = wheel.now + (1ULL << (WHEEL_BITS * WHEEL_LEVELS)) - 1;
+
+	int idx = (expires >> (WHEEL_BITS * level)) & WHEEL_MASK;
+	timer_link(t, &wheel.slot[level][idx]);
+}
+
+// move a higher level slot down, returns its index
+static int wheel_cascade(int level)
+{
+	int idx = (wheel.now >> (WHEEL_BITS * level)) & WHEEL_MASK;
+	struct co_timer *head = &wheel.slot[level][idx];
+
+	while (head->next != head) {
+		struct co_timer *t = head->next;
+		timer_unlink(t);
+		wheel_insert(t);
+	}
+
+	return idx;
+}
+
+// run every tick up to tick, expired timers go to fired
+static void wheel_run(uint64_t tick, struct co_timer *fired)
+{
+	while (wheel.now <= tick) {
+		if (wheel.count == 0) {
+			wheel.now = tick + 1;
+			break;
+		}
+
+		int idx = wheel.now & WHEEL_MASK;
+		for (int l = 1; l < WHEEL_LEVELS && idx == 0; l++)
+			idx = wheel_cascade(l);
+
+		struct co_timer *head = &wheel.slot[0][wheel.now & WHEEL_MASK];
+		while (head->next != head) {
+			struct co_timer *t = head->next;
+			timer_unlink(t);
+			t->state = TIMER_FIRING;
+			wheel.count--;
+			timer_link(t, fired);
+		}
+
+		wheel.now++;
+	}
+}
+
+// first tick anything may fire or cascade down, UINT64_MAX if none
+static uint64_t wheel_next()
+{
+	uint64_t next = UINT64_MAX;
+
+	if (wheel.count == 0)
+		return next;
+
+	for (int i = 0; i < WHEEL_SIZE; i++) {
+		struct co_timer *head = &wheel.slot[0][(wheel.now + i) & WHEEL_MASK];
+		if (head->next != head) {
+			next = wheel.now + i;
+			break;
+		}
+	}
+
+	for (int l = 1; l < WHEEL_LEVELS; l++) {
+		int shift = WHEEL_BITS * l;
+		uint64_t block = wheel.now >> shift;
+		for (int i = 1; i <= WHEEL_SIZE; i++) {
+			struct co_timer *head = &wheel.slot[l][(block + i) & WHEEL_MASK];
+			if (head->next != head) {
+				if (((block + i) << shift) < next)
+					next = (block + i) << shift;
+				break;
+			}
+		}
+	}
+
+	return next;
+}
+
+static void timer_fire_all(struct co_timer *fired)
+{
+	while (fired->next != fired) {
+		struct co_timer *t = fired->next;
+		timer_unlink(t);
+
+		firing.t = t;
+		firing.rearmed = 0;
+		firing.freed = 0;
+		t->fire(t);
+		firing.t = NULL;
+
+		if (firing.freed)
+			free(t);
+		else if (!firing.rearmed)
+			// t may go away right after this
+			__atomic_store_n(&t->state, TIMER_IDLE, __ATOMIC_RELEASE);
+	}
+}
+
+static int timer_pending()
+{
+	return __atomic_load_n(&wheel.count, __ATOMIC_SEQ_CST) > 0;
+}
+
+// called by the scheduler, never blocks on the wheel
+static void timer_poll()
+{
+	if (__atomic_load_n(&wheel.count, __ATOMIC_RELAXED) == 0)
+		return;
+
+	uint64_t tick = clock_ns() / TIMER_TICK_NS;
+	if (tick < __atomic_load_n(&wheel.now, __ATOMIC_RELAXED))
+		return;
+
+	if (__atomic_exchange_n(&wheel.lock.locked, 1, __ATOMIC_ACQUIRE))
+		return;
+
+	struct co_timer fired = { &fired, &fired };
+	wheel_run(tick, &fired);
+	spin_unlock(&wheel.lock);
+
+	timer_fire_all(&fired);
+}
+
+// ms until the next timer for epoll_wait(), -1 if none
+static int timer_timeout()
+{
+	if (__atomic_load_n(&wheel.count, __ATOMIC_RELAXED) == 0)
+		return -1;
+
+	spin_lock(&wheel.lock);
+	uint64_t next = wheel_next();
+	spin_unlock(&wheel.lock);
+
+	if (next == UINT64_MAX)
+		return -1;
+
+	uint64_t deadline = next * TIMER_TICK_NS;
+	if (deadline < __atomic_load_n(&poll_deadline, __ATOMIC_RELAXED))
+		__atomic_store_n(&poll_deadline, deadline, __ATOMIC_SEQ_CST);
+
+	uint64_t now = clock_ns();
+	if (deadline <= now)
+		return 0;
+	// round up, waking early only costs another epoll_wait(); timers
+	// more than INT_MAX ms out just take several waits to reach
+	uint64_t ms = (deadline - now + 999999) / 1000000;
+	return ms > INT_MAX ? INT_MAX : (int)ms;
+}
+
+static void timer_setup(struct co_timer *t, void (*fire)(struct co_timer *))
+{
+	memset(t, 0, sizeof(struct co_timer));
+	t->fire = fire;
+}
+
+static void timer_arm(struct co_timer *t, uint64_t ns)
+{
+	pthread_once(&timer_once, timer_init);
+
+	uint64_t now = clock_ns();
+	uint64_t deadline = ns > UINT64_MAX - now ? UINT64_MAX : now + ns;
+
+	co_timer_cancel(t);
+	if (t == firing.t)
+		firing.rearmed = 1;
+
+	spin_lock(&wheel.lock);
+	// round up, never fire early
+	t->expires = (deadline + TIMER_TICK_NS - 1) / TIMER_TICK_NS;
+	t->state = TIMER_PENDING;
+	wheel_insert(t);
+	wheel.count++;
+	spin_unlock(&wheel.lock);
+
+	if (deadline < __atomic_load_n(&poll_deadline, __ATOMIC_SEQ_CST))
+		reactor_kick();
+}
+
+// a pending t fires at the next tick instead, once as always
+static void timer_expedite(struct co_timer *t)
+{
+	spin_lock(&wheel.lock);
+	if (t->state == TIMER_PENDING) {
+		timer_unlink(t);
+		t->expires = wheel.now;
+		wheel_insert(t);
+	}
+	spin_unlock(&wheel.lock);
+
+	// the poller may be sleeping until the old deadline
+	if (__atomic_load_n(&poll_deadline, __ATOMIC_SEQ_CST))
+		reactor_kick();
+}
+
+static void timer_call(struct co_timer *t)
+{
+	t->func(t->arg);
+}
+
+struct co_timer *co_timer_new(void (*func)(void *), void *arg)
+{
+	struct co_timer *t = malloc(sizeof(struct co_timer));
+	if (!t)
+		return NULL;
+
+	timer_setup(t, timer_call);
+	t->func = func;
+	t->arg = arg;
+	return t;
+}
+
+void co_timer_free(struct co_timer *t)
+{
+	co_timer_cancel(t);
+	// from its own func, timer_fire_all() still holds t
+	if (t == firing.t)
+		firing.freed = 1;
+	else
+		free(t);
+}
+
+void co_timer_arm(struct co_timer *t, uint64_t ns)
+{
+	timer_arm(t, ns);
+}
+
+int co_timer_cancel(struct co_timer *t)
+{
+	int ret = -1;
+
+	if (__atomic_load_n(&t->state, __ATOMIC_ACQUIRE) == TIMER_IDLE)
+		return ret;
+
+	spin_lock(&wheel.lock);
+	if (t->state == TIMER_PENDING) {
+		timer_unlink(t);
+		t->state = TIMER_IDLE;
+		wheel.count--;
+		ret = 0;
+	}
+	spin_unlock(&wheel.lock);
+
+	// from its own func, nothing to wait for
+	if (t == firing.t && !firing.rearmed)
+		return ret;
+
+	// fire() is running, it may still touch t
+	while (__atomic_load_n(&t->state, __ATOMIC_ACQUIRE) == TIMER_FIRING)
+		cpu_relax();
+
+	return ret;
+}
+
+// co's own timer for co_sleep()/co_wait_timeout()
+static struct co_timer *co_timer_get(struct co *co)
+{
+	if (!co->timer) {
+		co->timer = malloc(sizeof(struct co_timer));
+		assert(co->timer);
+	}
+	return co->timer;
+}
+
+static void sleep_fire(struct co_timer *t)
+{
+	// wait for the sleeper to be off its stack
+	spin_lock(&t->lock);
+	struct co *co = t->co;
+	spin_unlock(&t->lock);
+
+	co_ready(co);
+}
+
+int co_sleep(uint64_t ns)
+{
+	sched_self();
+	if (__atomic_load_n(&current->cancelled, __ATOMIC_ACQUIRE))
+		return -1;
+
+	struct co_timer *t = co_timer_get(current);
+	timer_setup(t, sleep_fire);
+	t->co = current;
+
+	// co_cancel() may cut it short from here on
+	spin_lock(&current->lock);
+	current->sleep = t;
+	spin_unlock(&current->lock);
+
+	spin_lock(&t->lock);
+	timer_arm(t, ns);
+	// a co_cancel() that found t before it was armed is seen here
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	if (__atomic_load_n(&current->cancelled, __ATOMIC_RELAXED))
+		timer_expedite(t);
+	co_park(&t->lock, "co_sleep");
+
+	spin_lock(&current->lock);
+	current->sleep = NULL;
+	spin_unlock(&current->lock);
+
+	// t is set up afresh next time, make sure sleep_fire() is done with it
+	co_timer_cancel(t);
+
+	return __atomic_load_n(&current->cancelled, __ATOMIC_ACQUIRE) ? -1 : 0;
+}
+
+static void wait_fire(struct co_timer *t)
+{
+	struct co *target = t->arg;
+	struct co *co = NULL;
+
+	spin_lock(&target->lock);
+	if (target->waiter == t->co) {
+		target->waiter = NULL;
+		t->fired = 1;
+		co = t->co;
+	}
+	spin_unlock(&target->lock);
+
+	if (co)
+		co_ready(co);
+}
+
+int co_wait_timeout(struct co *co, uint64_t ns)
+{
+	sched_self();
+	struct co_timer *t = co_timer_get(current);
+
+	spin_lock(&co->lock);
+	assert(co->waiter == NULL);
+
+	if (co->status != CO_DEAD) {
+		timer_setup(t, wait_fire);
+		t->co = current;
+		t->arg = co;
+
+		co->waiter = current;
+		timer_arm(t, ns);
+		co_park(&co->lock, "co_wait_timeout");
+
+		co_timer_cancel(t);
+		if (t->fired)
+			return -1;
+	} else {
+		spin_unlock(&co->lock);
+	}
+
+	assert(co->status == CO_DEAD);
+	co_free(co);
+	return 0;
+}
+
+//===============================================================
+// offload thread pool
+//===============================================================
+
+struct offload_job {
+	void *(*func)(void *);
+	void *arg;
+	void *ret;
+	struct co *co;
+	// held by co until it is off its stack, see co_park()
+	spinlock_t lock;
+	struct offload_job *next;
+};
+
+static struct {
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	// FIFO of jobs nobody picked up yet
+	struct offload_job *head;
+	struct offload_job **tail;
+	int nqueued;
+	int nthreads;
+	int nwaiting;
+} pool = {
+	.mutex = PTHREAD_MUTEX_INITIALIZER,
+	.cond = PTHREAD_COND_INITIALIZER,
+	.tail = &pool.head,
+};
+
+// finished jobs, pushed by offload threads, taken all at once by the poller
+static struct offload_job *offload_done;
+
+static void *offload_worker(void *arg)
+{
+	for (;;) {
+		pthread_mutex_lock(&pool.mutex);
+		while (!pool.head) {
+			pool.nwaiting++;
+			pthread_cond_wait(&pool.cond, &pool.mutex);
+			pool.nwaiting--;
+		}
+		struct offload_job *job = pool.head;
+		pool.head = job->next;
+		if (!pool.head)
+			pool.tail = &pool.head;
+		pool.nqueued--;
+		pthread_mutex_unlock(&pool.mutex);
+
+		job->ret = job->func(job->arg);
+
+		// only the push that finds the list empty has to kick
+		struct offload_job *head = __atomic_load_n(&offload_done, __ATOMIC_RELAXED);
+		do {
+			job->next = head;
+		} while (!__atomic_compare_exchange_n(&offload_done, &head, job, 1,
+				__ATOMIC_RELEASE, __ATOMIC_RELAXED));
+		if (!head)
+			reactor_kick();
+	}
+
+	return NULL;
+}
+
+// wake the co of every finished job, called by the thread that read evfd
+static void offload_complete()
+{
+	struct offload_job *job = __atomic_exchange_n(&offload_done, NULL, __ATOMIC_ACQUIRE);
+
+	while (job) {
+		// co frees job once it runs again
+		struct offload_job *next = job->next;
+		struct co *co = job->co;
+
+		spin_lock(&job->lock);
+		spin_unlock(&job->lock);
+		co_ready(co);
+
+		job = next;
+	}
+}
+
+void *co_offload(void *(*func)(void *), void *arg)
+{
+	// not on the stack: the pool writes to it while co is parked, and a
+	// shared stack is overwritten by then
+	struct offload_job *job = calloc(1, sizeof(struct offload_job));
+	assert(job);
+	job->func = func;
+	job->arg = arg;
+
+	sched_self();
+	// completions come in through the reactor's eventfd
+	pthread_once(&reactor_once, reactor_init);
+
+	job->co = current;
+	spin_lock(&job->lock);
+	__atomic_add_fetch(&noffload, 1, __ATOMIC_SEQ_CST);
+
+	pthread_mutex_lock(&pool.mutex);
+	*pool.tail = job;
+	pool.tail = &job->next;
+	pool.nqueued++;
+	if (pool.nwaiting)
+		pthread_cond_signal(&pool.cond);
+	// more queued than threads about to pick them up, add one
+	if (pool.nqueued > pool.nwaiting && pool.nthreads < OFFLOAD_MAX) {
+		pthread_t tid;
+		if (pthread_create(&tid, NULL, offload_worker, NULL) == 0) {
+			pthread_detach(tid);
+			pool.nthreads++;
+		}
+	}
+	assert(pool.nthreads > 0);
+	pthread_mutex_unlock(&pool.mutex);
+
+	co_park(&job->lock, "co_offload");
+	// only now, as in fd_wait(): until co is on a run queue the
+	// deadlock check must still count it as something to wake
+	__atomic_sub_fetch(&noffload, 1, __ATOMIC_SEQ_CST);
+
+	void *ret = job->ret;
+	free(job);
+	return ret;
+}
+
+//===============================================================
+// groups and cancellation
+//===============================================================
+
+struct co_group {
+	spinlock_t lock;
+	// running children, sib_prev/sib_next
+	struct co *live;
+	int nlive;
+	// exited children nobody reaped yet
+	struct co_queue done;
+	// parked in co_group_wait*()
+	struct co *waiter;
+	int cancelled;
+};
+
+struct co_group *co_group_new()
+{
+	return calloc(1, sizeof(struct co_group));
+}
+
+void co_group_free(struct co_group *g)
+{
+	co_group_cancel(g);
+	co_group_wait(g);
+	free(g);
+}
+
+struct co *co_group_spawn(struct co_group *g, const char *name,
+		void (*func)(void *), void *arg)
+{
+	struct co *co = co_create(name, func, arg, NULL);
+	if (!co)
+		return NULL;
+
+	co->group = g;
+	spin_lock(&g->lock);
+	co->sib_next = g->live;
+	if (g->live)
+		g->live->sib_prev = co;
+	g->live = co;
+	g->nlive++;
+	co->cancelled = g->cancelled;
+	spin_unlock(&g->lock);
+
+	co_ready(co);
+	return co;
+}
+
+// from finish_switch(), co is dead and off its stack
+static void group_exit(struct co *co)
+{
+	struct co_group *g = co->group;
+
+	spin_lock(&g->lock);
+	if (co->sib_prev)
+		co->sib_prev->sib_next = co->sib_next;
+	else
+		g->live = co->sib_next;
+	if (co->sib_next)
+		co->sib_next->sib_prev = co->sib_prev;
+	g->nlive--;
+	queue_push(&g->done, co);
+
+	struct co *waiter = g->waiter;
+	g->waiter = NULL;
+	spin_unlock(&g->lock);
+
+	if (waiter)
+		co_ready(waiter);
+}
+
+// next exited child, parks for one, NULL once the group is empty
+static struct co *group_next_done(struct co_group *g, const char *wait_on)
+{
+	sched_self();
+
+	for (;;) {
+		spin_lock(&g->lock);
+		struct co *co = queue_pop(&g->done);
+		if (co || !g->nlive) {
+			spin_unlock(&g->lock);
+			return co;
+		}
+		assert(g->waiter == NULL);
+		g->waiter = current;
+		co_park(&g->lock, wait_on);
+	}
+}
+
+void co_group_wait(struct co_group *g)
+{
+	struct co *co;
+
+	while ((co = group_next_done(g, "co_group_wait")))
+		co_wait(co);
+}
+
+struct co *co_group_wait_any(struct co_group *g)
+{
+	return group_next_done(g, "co_group_wait_any");
+}
+
+// mark co and cut a co_sleep() short, g->lock held
+static void co_cancel(struct co *co)
+{
+	__atomic_store_n(&co->cancelled, 1, __ATOMIC_SEQ_CST);
+
+	// sleep is cleared before t leaves the sleeper's stack
+	spin_lock(&co->lock);
+	if (co->sleep)
+		timer_expedite(co->sleep);
+	spin_unlock(&co->lock);
+}
+
+void co_group_cancel(struct co_group *g)
+{
+	spin_lock(&g->lock);
+	g->cancelled = 1;
+	for (struct co *co = g->live; co; co = co->sib_next)
+		co_cancel(co);
+	spin_unlock(&g->lock);
+}
+
+int co_cancelled()
+{
+	sched_self();
+	return __atomic_load_n(&current->cancelled, __ATOMIC_ACQUIRE);
+}
+
+//===============================================================
+// co-local storage
+//===============================================================
+
+static struct {
+	spinlock_t lock;
+	// bumped by co_key_new(), odd while the key is in use
+	unsigned int seq[CO_KEYS_MAX];
+	void (*dtor[CO_KEYS_MAX])(void *);
+} keys;
+
+int co_key_new(void (*dtor)(void *))
+{
+	int key = -1;
+
+	spin_lock(&keys.lock);
+	for (int k = 0; k < CO_KEYS_MAX; k++) {
+		if (!(keys.seq[k] & 1)) {
+			keys.dtor[k] = dtor;
+			__atomic_store_n(&keys.seq[k], keys.seq[k] + 1, __ATOMIC_RELEASE);
+			key = k;
+			break;
+		}
+	}
+	spin_unlock(&keys.lock);
+
+	return key;
+}
+
+void co_key_free(int key)
+{
+	assert(key >= 0 && key < CO_KEYS_MAX);
+
+	spin_lock(&keys.lock);
+	assert(keys.seq[key] & 1);
+	// every value set under it goes stale, destructors are not run
+	__atomic_store_n(&keys.seq[key], keys.seq[key] + 1, __ATOMIC_RELEASE);
+	keys.dtor[key] = NULL;
+	spin_unlock(&keys.lock);
+}
+
+void *co_local_get(int key)
+{
+	sched_self();
+
+	struct local_slot *slot = current->local;
+	if (!slot || slot[key].seq != __atomic_load_n(&keys.seq[key], __ATOMIC_RELAXED))
+		return NULL;
+	return slot[key].value;
+}
+
+int co_local_set(int key, void *value)
+{
+	sched_self();
+
+	if (!current->local) {
+		current->local = calloc(CO_KEYS_MAX, sizeof(struct local_slot));
+		if (!current->local)
+			return -1;
+	}
+	current->local[key].seq = __atomic_load_n(&keys.seq[key], __ATOMIC_RELAXED);
+	current->local[key].value = value;
+	return 0;
+}
+
+// run destructors of co's live values, like pthread keys do at exit
+static void local_destroy(struct co *co)
+{
+	struct local_slot *slot = co->local;
+
+	if (!slot)
+		return;
+
+	for (int pass = 0; pass < LOCAL_DTOR_PASSES; pass++) {
+		int again = 0;
+
+		for (int k = 0; k < CO_KEYS_MAX; k++) {
+			void *value = slot[k].value;
+			if (!value || slot[k].seq != __atomic_load_n(&keys.seq[k], __ATOMIC_ACQUIRE))
+				continue;
+
+			slot[k].value = NULL;
+			void (*dtor)(void *) = keys.dtor[k];
+			if (dtor) {
+				dtor(value);
+				again = 1;
+			}
+		}
+		if (!again)
+			break;
 	}
 }
@@ -1,3 +1,196 @@
+#ifndef __CO_H
+#define __CO_H
+
+#include <stdint.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+
+// run on a stack shared with other CO_SHARED_STACK co, only the used
+// part is saved/restored when switching, trading switch cost for memory
+#define CO_SHARED_STACK 0x1
+// not scheduled, runs only inside co_resume() until it yields a value
+#define CO_GENERATOR 0x2
+
+// run queue classes, a lower one still runs now and then
+#define CO_PRIO_HIGH   -1
+#define CO_PRIO_NORMAL 0
+#define CO_PRIO_LOW    1
+
+struct co_attr {
+	unsigned int flags;
+	// private stack, 0 for the 64KB default
+	size_t stack_size;
+	// CO_PRIO_*, 0 is normal
+	int prio;
+};
+
 struct co* co_start(const char *name, void (*func)(void *), void *arg);
-void co_yield();
+struct co* co_start_attr(const char *name, void (*func)(void *), void *arg,
+		const struct co_attr *attr);
+// -1 if the co has been cancelled, it should return and clean up
+int co_yield();
 void co_wait(struct co *co);
+// -1 if co is still alive after ns, it is not freed then
+int co_wait_timeout(struct co *co, uint64_t ns);
+// park for at least ns, 1ms resolution
+// -1 if the co has been cancelled, the sleep may have been cut short
+int co_sleep(uint64_t ns);
+
+// generators: co_resume() hands *value to a CO_GENERATOR co and switches
+// to it directly, its co_yield_value() hands one back the same way
+// the first call starts it and its value is not seen
+// -1 once it has returned, co_wait() it then
+int co_resume(struct co *co, void **value);
+// the value passed by the next co_resume()
+void *co_yield_value(void *value);
+// end a generator that is still suspended and free it: it is cancelled
+// and resumed with NULL until it returns, so it should check
+// co_cancelled() after each co_yield_value()
+void co_gen_close(struct co *co);
+
+// run co on nthreads threads (the caller included), returns how many do
+int co_set_threads(int nthreads);
+// off by default: abort with a list of the parked co once every thread
+// is idle and no fd, timer or co_offload() can wake them. Only for
+// programs whose threads never call into libco from outside it, a
+// plain pthread may still co_chan_send() and the like.
+void co_set_deadlock_check(int on);
+
+// channels, blocking calls park the co instead of spinning
+#define CO_CHAN_UNBOUNDED -1
+
+struct co_chan;
+
+// cap == 0: every send waits for a receiver
+struct co_chan *co_chan_new(int cap);
+void co_chan_free(struct co_chan *ch);
+// -1 if ch is closed
+int co_chan_send(struct co_chan *ch, void *data);
+// -1 if ch is closed and drained
+int co_chan_recv(struct co_chan *ch, void **data);
+// wake every parked sender and receiver
+void co_chan_close(struct co_chan *ch);
+
+// blocking primitives, waiters park in FIFO order and are handed the
+// lock/unit directly
+struct co_mutex;
+struct co_cond;
+struct co_sem;
+struct co_wg;
+
+struct co_mutex *co_mutex_new();
+void co_mutex_free(struct co_mutex *m);
+void co_mutex_lock(struct co_mutex *m);
+// -1 if m is held
+int co_mutex_trylock(struct co_mutex *m);
+void co_mutex_unlock(struct co_mutex *m);
+
+struct co_cond *co_cond_new();
+void co_cond_free(struct co_cond *c);
+void co_cond_wait(struct co_cond *c, struct co_mutex *m);
+void co_cond_signal(struct co_cond *c);
+void co_cond_broadcast(struct co_cond *c);
+
+struct co_sem *co_sem_new(int count);
+void co_sem_free(struct co_sem *sem);
+void co_sem_wait(struct co_sem *sem);
+void co_sem_post(struct co_sem *sem);
+
+// wait group, co_wg_wait() returns once the count drops to 0
+struct co_wg *co_wg_new();
+void co_wg_free(struct co_wg *wg);
+void co_wg_add(struct co_wg *wg, int n);
+void co_wg_done(struct co_wg *wg);
+void co_wg_wait(struct co_wg *wg);
+
+// I/O that parks the co instead of blocking the thread, the fd is
+// switched to O_NONBLOCK on first use. One reader and one writer may
+// wait on an fd at a time. Close such fds with co_close().
+ssize_t co_read(int fd, void *buf, size_t count);
+ssize_t co_write(int fd, const void *buf, size_t count);
+int co_accept(int fd, struct sockaddr *addr, socklen_t *addrlen);
+int co_connect(int fd, const struct sockaddr *addr, socklen_t addrlen);
+int co_close(int fd);
+
+// timers on a hierarchical timing wheel, O(1) arm and cancel, 1ms
+// resolution. func runs on a scheduler thread and must not block.
+struct co_timer;
+
+struct co_timer *co_timer_new(void (*func)(void *), void *arg);
+void co_timer_free(struct co_timer *t);
+// (re)arm to fire ns from now, func may re-arm, cancel or free its own t
+void co_timer_arm(struct co_timer *t, uint64_t ns);
+// -1 if t was not pending, returns after a running func is done
+int co_timer_cancel(struct co_timer *t);
+
+// groups: spawn children, then wait for all or any of them. Children
+// are freed by the group, never co_wait() them while they run.
+// A cancelled child is never torn down from outside: co_yield() and
+// co_sleep() return -1 (co_cancelled() tells the same) and the child
+// unwinds and returns by itself; one already sleeping wakes up early.
+struct co_group;
+
+struct co_group *co_group_new();
+// cancels what is still running and waits for it
+void co_group_free(struct co_group *g);
+struct co *co_group_spawn(struct co_group *g, const char *name,
+		void (*func)(void *), void *arg);
+void co_group_wait(struct co_group *g);
+// a child that has exited, co_wait() it to free; NULL if none is left
+struct co *co_group_wait_any(struct co_group *g);
+void co_group_cancel(struct co_group *g);
+int co_cancelled();
+
+// co-local storage, like pthread keys but per co. dtor runs on the
+// exiting co for every value still set under the key.
+#define CO_KEYS_MAX 64
+
+// -1 once CO_KEYS_MAX are in use
+int co_key_new(void (*dtor)(void *));
+void co_key_free(int key);
+// NULL if the calling co never set one
+void *co_local_get(int key);
+int co_local_set(int key, void *value);
+
+// run func(arg) on a pool of plain threads and park until it returns,
+// for blocking syscalls and long computations. Returns what func did.
+void *co_offload(void *(*func)(void *), void *arg);
+
+// instrumentation, everything reads 0 unless built with -DCO_STATS
+#define CO_LAT_BUCKETS 40
+
+struct co_stats {
+	// times scheduled in
+	uint64_t switches;
+	// on cpu
+	uint64_t run_ns;
+	// runnable but waiting for a thread
+	uint64_t ready_ns;
+};
+
+// co == NULL for the calling co
+void co_get_stats(struct co *co, struct co_stats *st);
+// runnable-to-running latency, hist[i] counts waits in [2^i, 2^(i+1)) ns
+void co_latency_histogram(uint64_t hist[CO_LAT_BUCKETS]);
+// run slices of the last 64K switches as Chrome trace JSON
+int co_trace_dump(const char *path);
+
+// deepest stack use so far, read back from the paint co_start() lays
+// down; co == NULL for the calling co
+size_t co_stack_usage(struct co *co);
+
+// co_stack_usage() of every co freed by co_wait(), to right-size
+// co_attr.stack_size
+#define CO_STACK_BUCKETS 32
+
+struct co_stack_stats {
+	uint64_t count;
+	uint64_t max;
+	uint64_t total;
+	// hist[i] counts co that used [2^i, 2^(i+1)) bytes
+	uint64_t hist[CO_STACK_BUCKETS];
+};
+
+void co_get_stack_stats(struct co_stack_stats *st);
+
+#endif
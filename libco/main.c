@@ -2,6 +2,15 @@
 #include <stdlib.h>
 #include <assert.h>
 #include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <sys/wait.h>
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
 #include "co-test.h"
 
 int g_count = 0;
@@ -42,65 +51,60 @@ static void test_1() {
 
 static int g_running = 1;
 
-static void do_produce(Queue *queue) {
-    assert(!q_is_full(queue));
-    Item *item = (Item*)malloc(sizeof(Item));
-    if (!item) {
-        fprintf(stderr, "New item failure\n");
-        return;
-    }
-    item->data = (char*)malloc(10);
-    if (!item->data) {
+// returns -1 if ring is full
+static int do_produce(Mpmc *ring) {
+    char *data = (char*)malloc(10);
+    if (!data) {
         fprintf(stderr, "New data failure\n");
-        free(item);
-        return;
+        return 0;
     }
-    memset(item->data, 0, 10);
-    sprintf(item->data, "libco-%d", g_count++);
-    q_push(queue, item);
+    memset(data, 0, 10);
+    sprintf(data, "libco-%d", g_count);
+    if (mpmc_push(ring, data) != 0) {
+        free(data);
+        return -1;
+    }
+    g_count++;
+    return 0;
 }
 
 static void producer(void *arg) {
-    Queue *queue = (Queue*)arg;
+    Mpmc *ring = (Mpmc*)arg;
     for (int i = 0; i < 100; ) {
-        if (!q_is_full(queue)) {
-            // co_yield();
-            do_produce(queue);
+        if (do_produce(ring) == 0) {
             i += 1;
         }
         co_yield();
     }
 }
 
-static void do_consume(Queue *queue) {
-    assert(!q_is_empty(queue));
-
-    Item *item = q_pop(queue);
-    if (item) {
-        printf("%s  ", (char *)item->data);
-        free(item->data);
-        free(item);
+// returns -1 if ring is empty
+static int do_consume(Mpmc *ring) {
+    void *data;
+    if (mpmc_pop(ring, &data) != 0) {
+        return -1;
     }
+    printf("%s  ", (char *)data);
+    free(data);
+    return 0;
 }
 
 static void consumer(void *arg) {
-    Queue *queue = (Queue*)arg;
+    Mpmc *ring = (Mpmc*)arg;
     while (g_running) {
-        if (!q_is_empty(queue)) {
-            do_consume(queue);
-        }
+        do_consume(ring);
         co_yield();
     }
 }
 
 static void test_2() {
 
-    Queue *queue = q_new();
+    Mpmc *ring = mpmc_new(100);
 
-    struct co *thd1 = co_start("producer-1", producer, queue);
-    struct co *thd2 = co_start("producer-2", producer, queue);
-    struct co *thd3 = co_start("consumer-1", consumer, queue);
-    struct co *thd4 = co_start("consumer-2", consumer, queue);
+    struct co *thd1 = co_start("producer-1", producer, ring);
+    struct co *thd2 = co_start("producer-2", producer, ring);
+    struct co *thd3 = co_start("consumer-1", consumer, ring);
+    struct co *thd4 = co_start("consumer-2", consumer, ring);
 
     co_wait(thd1);
     co_wait(thd2);
@@ -110,14 +114,844 @@ static void test_2() {
     co_wait(thd3);
     co_wait(thd4);
 
-    while (!q_is_empty(queue)) {
-        do_consume(queue);
+    while (do_consume(ring) == 0) {
+    }
+
+    mpmc_free(ring);
+}
+
+// -----------------------------------------------
+
+static void shared_work(void *arg) {
+    // locals must survive the copy on and off the shared stack
+    char buf[64];
+    int sum = 0;
+    memset(buf, *(const char *)arg, sizeof(buf));
+    for (int i = 0; i < 100; ++i) {
+        sum += buf[i % sizeof(buf)];
+        add_count();
+        co_yield();
+    }
+    assert(sum == 100 * *(const char *)arg);
+}
+
+static void test_3() {
+    struct co_attr attr = { .flags = CO_SHARED_STACK };
+
+    int base = get_count();
+    struct co *thd1 = co_start_attr("shared-1", shared_work, "S", &attr);
+    struct co *thd2 = co_start_attr("shared-2", shared_work, "T", &attr);
+    struct co *thd3 = co_start("private-1", shared_work, "P");
+
+    co_wait(thd1);
+    co_wait(thd2);
+    co_wait(thd3);
+
+    printf("%d", get_count() - base);
+}
+
+// -----------------------------------------------
+
+#define MN_CO 16
+#define MN_ROUNDS 1000
+
+static int g_mn_count = 0;
+
+static void mn_work(void *arg) {
+    for (int i = 0; i < MN_ROUNDS; ++i) {
+        __atomic_fetch_add(&g_mn_count, 1, __ATOMIC_RELAXED);
+        co_yield();
+    }
+}
+
+// co_wait from a co that may migrate between threads
+static void mn_parent(void *arg) {
+    struct co *child = co_start("mn-child", mn_work, NULL);
+    mn_work(arg);
+    co_wait(child);
+}
+
+static void test_4() {
+    struct co *thds[MN_CO];
+
+    printf("%d threads: ", co_set_threads(4));
+
+    for (int i = 0; i < MN_CO; ++i) {
+        thds[i] = co_start("mn-parent", mn_parent, NULL);
+    }
+    for (int i = 0; i < MN_CO; ++i) {
+        co_wait(thds[i]);
+    }
+
+    printf("%d", g_mn_count);
+}
+
+// -----------------------------------------------
+
+static int g_chan_sum = 0;
+static int g_chan_items = 0;
+
+static void chan_producer(void *arg) {
+    struct co_chan *ch = (struct co_chan *)arg;
+    for (long i = 0; i < 100; ++i) {
+        co_chan_send(ch, (void *)i);
+    }
+}
+
+static void chan_consumer(void *arg) {
+    struct co_chan *ch = (struct co_chan *)arg;
+    void *data;
+    // no polling: parks until data arrives or ch is closed
+    while (co_chan_recv(ch, &data) == 0) {
+        __atomic_fetch_add(&g_chan_sum, (int)(long)data, __ATOMIC_RELAXED);
+        __atomic_fetch_add(&g_chan_items, 1, __ATOMIC_RELAXED);
+    }
+}
+
+static void test_5() {
+    int caps[] = { 0, 4, CO_CHAN_UNBOUNDED };
+
+    for (int i = 0; i < 3; ++i) {
+        struct co_chan *ch = co_chan_new(caps[i]);
+
+        g_chan_sum = g_chan_items = 0;
+
+        struct co *thd1 = co_start("producer-1", chan_producer, ch);
+        struct co *thd2 = co_start("producer-2", chan_producer, ch);
+        struct co *thd3 = co_start("consumer-1", chan_consumer, ch);
+        struct co *thd4 = co_start("consumer-2", chan_consumer, ch);
+
+        co_wait(thd1);
+        co_wait(thd2);
+
+        co_chan_close(ch);
+
+        co_wait(thd3);
+        co_wait(thd4);
+        co_chan_free(ch);
+
+        printf("%d/%d  ", g_chan_items, g_chan_sum);
+    }
+}
+
+// -----------------------------------------------
+
+#define SYNC_CO 8
+#define SYNC_ROUNDS 100
+
+static struct co_mutex *g_mutex;
+static struct co_cond *g_cond;
+static struct co_sem *g_sem;
+static struct co_wg *g_wg;
+static int g_sync_count = 0;
+static int g_sync_inside = 0;
+static int g_sync_go = 0;
+
+static void sync_work(void *arg) {
+    // everybody starts together
+    co_mutex_lock(g_mutex);
+    while (!g_sync_go) {
+        co_cond_wait(g_cond, g_mutex);
+    }
+    co_mutex_unlock(g_mutex);
+
+    for (int i = 0; i < SYNC_ROUNDS; ++i) {
+        // yield inside the critical section, the mutex must hold
+        co_mutex_lock(g_mutex);
+        int count = g_sync_count;
+        co_yield();
+        g_sync_count = count + 1;
+        co_mutex_unlock(g_mutex);
+
+        // at most 2 co inside
+        co_sem_wait(g_sem);
+        assert(__atomic_add_fetch(&g_sync_inside, 1, __ATOMIC_RELAXED) <= 2);
+        co_yield();
+        __atomic_sub_fetch(&g_sync_inside, 1, __ATOMIC_RELAXED);
+        co_sem_post(g_sem);
+    }
+
+    co_wg_done(g_wg);
+}
+
+static void test_6() {
+    struct co *thds[SYNC_CO];
+
+    g_mutex = co_mutex_new();
+    g_cond = co_cond_new();
+    g_sem = co_sem_new(2);
+    g_wg = co_wg_new();
+
+    co_wg_add(g_wg, SYNC_CO);
+    for (int i = 0; i < SYNC_CO; ++i) {
+        thds[i] = co_start("sync", sync_work, NULL);
+    }
+
+    co_mutex_lock(g_mutex);
+    g_sync_go = 1;
+    co_cond_broadcast(g_cond);
+    co_mutex_unlock(g_mutex);
+
+    co_wg_wait(g_wg);
+    printf("%d", g_sync_count);
+
+    for (int i = 0; i < SYNC_CO; ++i) {
+        co_wait(thds[i]);
+    }
+
+    co_wg_free(g_wg);
+    co_sem_free(g_sem);
+    co_cond_free(g_cond);
+    co_mutex_free(g_mutex);
+}
+
+// -----------------------------------------------
+
+static int g_pipe[2];
+static int g_io_ticks = 0;
+
+static void io_reader(void *arg) {
+    char buf[16];
+    int total = 0;
+    ssize_t n;
+    // parks on the empty pipe, the ticker keeps running
+    while ((n = co_read(g_pipe[0], buf, sizeof(buf))) > 0) {
+        total += n;
+    }
+    *(int *)arg = total;
+}
+
+static void io_writer(void *arg) {
+    for (int i = 0; i < 10; ++i) {
+        for (int j = 0; j < 10; ++j) {
+            __atomic_fetch_add(&g_io_ticks, 1, __ATOMIC_RELAXED);
+            co_yield();
+        }
+        co_write(g_pipe[1], "libco", 5);
+    }
+    co_close(g_pipe[1]);
+}
+
+static void test_7() {
+    int total = 0;
+
+    assert(pipe(g_pipe) == 0);
+
+    struct co *thd1 = co_start("reader", io_reader, &total);
+    struct co *thd2 = co_start("writer", io_writer, NULL);
+
+    co_wait(thd1);
+    co_wait(thd2);
+    co_close(g_pipe[0]);
+
+    printf("%d/%d", total, g_io_ticks);
+}
+
+// -----------------------------------------------
+
+static char g_wake_order[8];
+static int g_wake_idx = 0;
+
+static void sleeper(void *arg) {
+    const char *s = (const char *)arg;
+    co_sleep((s[0] - 'a' + 1) * 10 * 1000000ULL);
+    g_wake_order[__atomic_fetch_add(&g_wake_idx, 1, __ATOMIC_RELAXED)] = s[0];
+}
+
+static int g_shared_naps;
+
+// the sleep timer must not live on a stack the next co overwrites
+static void shared_napper(void *arg) {
+    for (int i = 0; i < 20; i++) {
+        co_sleep(1000000ULL);
+        __atomic_fetch_add(&g_shared_naps, 1, __ATOMIC_RELAXED);
+    }
+}
+
+static void shared_waiter(void *arg) {
+    // times out at least once while the nappers share its stack
+    while (co_wait_timeout((struct co *)arg, 3 * 1000000ULL) < 0) {
+    }
+}
+
+static void test_8() {
+    struct co *thd1 = co_start("sleep-30ms", sleeper, "c");
+    struct co *thd2 = co_start("sleep-10ms", sleeper, "a");
+    struct co *thd3 = co_start("sleep-20ms", sleeper, "b");
+
+    // still sleeping after 1ms
+    printf("%d ", co_wait_timeout(thd1, 1000000ULL));
+
+    co_wait(thd2);
+    co_wait(thd3);
+    printf("%d ", co_wait_timeout(thd1, 1000 * 1000000ULL));
+
+    printf("%s ", g_wake_order);
+
+    struct co_attr attr = { .flags = CO_SHARED_STACK };
+    struct co *nappers[4];
+    for (int i = 0; i < 4; i++) {
+        nappers[i] = co_start_attr("shared-napper", shared_napper, NULL, &attr);
+    }
+    struct co *waiter = co_start_attr("shared-waiter", shared_waiter, nappers[0], &attr);
+    for (int i = 1; i < 4; i++) {
+        co_wait(nappers[i]);
+    }
+    co_wait(waiter);
+
+    printf("%d", g_shared_naps);
+}
+
+// -----------------------------------------------
+
+static size_t g_stack_used[2];
+
+static void deep(void *arg) {
+    volatile char frame[8192];
+    frame[0] = 1;
+    frame[sizeof(frame) - 1] = frame[0];
+    *(size_t *)arg = co_stack_usage(NULL);
+}
+
+static void shallow(void *arg) {
+    *(size_t *)arg = co_stack_usage(NULL);
+}
+
+static void test_10() {
+    struct co_attr attr = { .stack_size = 8 * 1024 };
+    struct co_stack_stats before, after;
+
+    co_get_stack_stats(&before);
+
+    struct co *thd1 = co_start("deep", deep, &g_stack_used[0]);
+    struct co *thd2 = co_start_attr("shallow", shallow, &g_stack_used[1], &attr);
+    co_wait(thd1);
+    co_wait(thd2);
+
+    co_get_stack_stats(&after);
+
+    printf("%s %s %d",
+           g_stack_used[0] >= 8192 ? "deep>=8KB" : "deep<8KB",
+           g_stack_used[1] < 4096 ? "shallow<4KB" : "shallow>=4KB",
+           (int)(after.count - before.count));
+}
+
+// -----------------------------------------------
+
+static char g_prio_order[8];
+static int g_high_yields, g_low_saw;
+
+static void record(void *arg) {
+    strcat(g_prio_order, (const char *)arg);
+}
+
+static void busy_high(void *arg) {
+    for (int i = 0; i < 50; i++) {
+        __atomic_fetch_add(&g_high_yields, 1, __ATOMIC_RELAXED);
+        co_yield();
+    }
+}
+
+static void starved_low(void *arg) {
+    g_low_saw = __atomic_load_n(&g_high_yields, __ATOMIC_RELAXED);
+}
+
+static void test_11() {
+    // shared stack pins them to this thread, so the order is ours to see
+    struct co_attr low = { .flags = CO_SHARED_STACK, .prio = CO_PRIO_LOW };
+    struct co_attr normal = { .flags = CO_SHARED_STACK, .prio = CO_PRIO_NORMAL };
+    struct co_attr high = { .flags = CO_SHARED_STACK, .prio = CO_PRIO_HIGH };
+
+    struct co *thd1 = co_start_attr("low", record, "L", &low);
+    struct co *thd2 = co_start_attr("normal", record, "N", &normal);
+    struct co *thd3 = co_start_attr("high", record, "H", &high);
+    co_wait(thd1);
+    co_wait(thd2);
+    co_wait(thd3);
+
+    struct co *thd4 = co_start_attr("busy-1", busy_high, NULL, &high);
+    struct co *thd5 = co_start_attr("busy-2", busy_high, NULL, &high);
+    struct co *thd6 = co_start_attr("starved", starved_low, NULL, &low);
+    co_wait(thd4);
+    co_wait(thd5);
+    co_wait(thd6);
+
+    printf("%s %s", g_prio_order,
+           g_low_saw < 100 ? "low not starved" : "low starved");
+}
+
+// -----------------------------------------------
+
+static void squares(void *arg) {
+    for (long i = 0; i < (long)arg; i++) {
+        co_yield_value((void *)(i * i));
+    }
+}
+
+static void running_sum(void *arg) {
+    long sum = 0;
+    // the value of the priming co_resume() is not seen
+    void *in = co_yield_value(NULL);
+    while (!co_cancelled()) {
+        sum += (long)in;
+        in = co_yield_value((void *)sum);
     }
+}
+
+static void test_12() {
+    struct co_attr attr = { .flags = CO_GENERATOR };
+    void *value;
+    long n = 0, sum = 0;
+
+    struct co *gen1 = co_start_attr("squares", squares, (void *)5, &attr);
+    while (co_resume(gen1, &value) == 0) {
+        n++;
+        sum += (long)value;
+    }
+    co_wait(gen1);
+
+    // endless, closed once we have had enough
+    struct co *gen2 = co_start_attr("running-sum", running_sum, NULL, &attr);
+    co_resume(gen2, NULL);
+    for (long i = 1; i <= 10; i++) {
+        value = (void *)i;
+        co_resume(gen2, &value);
+    }
+    co_gen_close(gen2);
+
+    printf("%ld %ld %ld", n, sum, (long)value);
+}
+
+// -----------------------------------------------
+
+#define RING_ITEMS 100000
+#define RING_BATCH 16
 
-    q_free(queue);
+static Spsc *g_spsc;
+static Mpmc *g_mpmc;
+static long g_ring_sum;
+
+// the next batch of 1..RING_ITEMS after next, how many
+static size_t ring_fill(void **batch, long next) {
+    size_t n = 0;
+    while (n < RING_BATCH && next + (long)n <= RING_ITEMS) {
+        batch[n] = (void *)(next + (long)n);
+        n++;
+    }
+    return n;
+}
+
+static long ring_add(void **batch, size_t n) {
+    long sum = 0;
+    for (size_t i = 0; i < n; i++) {
+        sum += (long)batch[i];
+    }
+    return sum;
 }
 
-int main() {
+static void *spsc_producer(void *arg) {
+    void *batch[RING_BATCH];
+    for (long next = 1; next <= RING_ITEMS; ) {
+        size_t n = spsc_push_n(g_spsc, batch, ring_fill(batch, next));
+        if (n == 0) {
+            sched_yield();
+        }
+        next += n;
+    }
+    return NULL;
+}
+
+static void *spsc_consumer(void *arg) {
+    void *batch[RING_BATCH];
+    for (long seen = 0; seen < RING_ITEMS; ) {
+        size_t n = spsc_pop_n(g_spsc, batch, RING_BATCH);
+        if (n == 0) {
+            sched_yield();
+        }
+        g_ring_sum += ring_add(batch, n);
+        seen += n;
+    }
+    return NULL;
+}
+
+static void *mpmc_producer(void *arg) {
+    void *batch[RING_BATCH];
+    for (long next = 1; next <= RING_ITEMS; ) {
+        size_t n = mpmc_push_n(g_mpmc, batch, ring_fill(batch, next));
+        if (n == 0) {
+            sched_yield();
+        }
+        next += n;
+    }
+    return NULL;
+}
+
+// takes RING_ITEMS, whoever pushed them
+static void *mpmc_consumer(void *arg) {
+    void *batch[RING_BATCH];
+    long sum = 0;
+    for (long seen = 0; seen < RING_ITEMS; ) {
+        size_t want = RING_ITEMS - seen < RING_BATCH ? RING_ITEMS - seen : RING_BATCH;
+        size_t n = mpmc_pop_n(g_mpmc, batch, want);
+        if (n == 0) {
+            sched_yield();
+        }
+        sum += ring_add(batch, n);
+        seen += n;
+    }
+    __atomic_fetch_add(&g_ring_sum, sum, __ATOMIC_RELAXED);
+    return NULL;
+}
+
+static void test_13() {
+    pthread_t tids[4];
+
+    g_spsc = spsc_new(64);
+    g_ring_sum = 0;
+    pthread_create(&tids[0], NULL, spsc_producer, NULL);
+    pthread_create(&tids[1], NULL, spsc_consumer, NULL);
+    for (int i = 0; i < 2; i++) {
+        pthread_join(tids[i], NULL);
+    }
+    printf("%ld ", g_ring_sum);
+    spsc_free(g_spsc);
+
+    g_mpmc = mpmc_new(64);
+    g_ring_sum = 0;
+    for (int i = 0; i < 2; i++) {
+        pthread_create(&tids[i], NULL, mpmc_producer, NULL);
+        pthread_create(&tids[i + 2], NULL, mpmc_consumer, NULL);
+    }
+    for (int i = 0; i < 4; i++) {
+        pthread_join(tids[i], NULL);
+    }
+    printf("%ld", g_ring_sum);
+    mpmc_free(g_mpmc);
+}
+
+// -----------------------------------------------
+
+static pthread_t g_main_tid;
+static int g_offloaded;
+
+static void *blocking_call(void *arg) {
+    // a real blocking syscall, would stall the scheduler thread
+    usleep(20 * 1000);
+    return pthread_equal(pthread_self(), g_main_tid) ? NULL : arg;
+}
+
+static void offloader(void *arg) {
+    if (co_offload(blocking_call, (void *)42L) == (void *)42L) {
+        __atomic_fetch_add(&g_offloaded, 1, __ATOMIC_RELAXED);
+    }
+}
+
+static void test_14() {
+    struct co *thds[8];
+    struct timespec start, end;
+
+    g_main_tid = pthread_self();
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int i = 0; i < 8; i++) {
+        thds[i] = co_start("offloader", offloader, NULL);
+    }
+    for (int i = 0; i < 8; i++) {
+        co_wait(thds[i]);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    // 160ms if they had run one after the other
+    long ms = (end.tv_sec - start.tv_sec) * 1000 + (end.tv_nsec - start.tv_nsec) / 1000000;
+    printf("%d %s ", g_offloaded, ms < 100 ? "overlapped" : "serialized");
+
+    // the pool fills in the job while these are off their shared stack
+    struct co_attr attr = { .flags = CO_SHARED_STACK };
+    for (int i = 0; i < 3; i++) {
+        thds[i] = co_start_attr("shared-offloader", offloader, NULL, &attr);
+    }
+    for (int i = 0; i < 3; i++) {
+        co_wait(thds[i]);
+    }
+    printf("%d", g_offloaded);
+}
+
+// -----------------------------------------------
+
+static int g_cleaned_up;
+static struct co_mutex *g_held;
+
+static void quick(void *arg) {
+}
+
+// holds a lock and a buffer across yields, both must be given back
+static void spinner(void *arg) {
+    co_mutex_lock(g_held);
+    char *buf = (char *)malloc(4096);
+    while (co_yield() == 0) {
+        buf[0]++;
+    }
+    free(buf);
+    co_mutex_unlock(g_held);
+    __atomic_fetch_add(&g_cleaned_up, 1, __ATOMIC_RELAXED);
+}
+
+static void napper(void *arg) {
+    if (co_sleep(10 * 1000 * 1000000ULL) < 0) {
+        __atomic_fetch_add(&g_cleaned_up, 1, __ATOMIC_RELAXED);
+    }
+}
+
+static void polite(void *arg) {
+    while (!co_cancelled()) {
+        co_sleep(1000000ULL);
+    }
+    __atomic_fetch_add(&g_cleaned_up, 1, __ATOMIC_RELAXED);
+}
+
+static void test_15() {
+    struct co_group *g = co_group_new();
+    struct timespec start, end;
+
+    g_held = co_mutex_new();
+    struct co *first = co_group_spawn(g, "quick", quick, NULL);
+    co_group_spawn(g, "spinner", spinner, NULL);
+    co_group_spawn(g, "napper", napper, NULL);
+    co_group_spawn(g, "polite", polite, NULL);
+
+    struct co *done = co_group_wait_any(g);
+    printf("%s ", done == first ? "quick" : "other");
+    co_wait(done);
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    co_group_cancel(g);
+    co_group_wait(g);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    // the napper would have slept 10s
+    long ms = (end.tv_sec - start.tv_sec) * 1000 + (end.tv_nsec - start.tv_nsec) / 1000000;
+    printf("%d %s", g_cleaned_up, ms < 1000 ? "prompt" : "slow");
+    co_group_free(g);
+
+    // a child dropped while holding it would deadlock here
+    co_mutex_lock(g_held);
+    printf(" unlocked");
+    co_mutex_unlock(g_held);
+    co_mutex_free(g_held);
+}
+
+// -----------------------------------------------
+
+static int g_key;
+static int g_local_ok, g_dtor_runs;
+
+static void drop_request(void *value) {
+    __atomic_fetch_add(&g_dtor_runs, 1, __ATOMIC_RELAXED);
+    free(value);
+}
+
+static void handler(void *arg) {
+    long *id = (long *)malloc(sizeof(long));
+    *id = (long)arg;
+    co_local_set(g_key, id);
+    for (int i = 0; i < 10; i++) {
+        co_yield();
+        // deep in some callee, no id passed down
+        if (*(long *)co_local_get(g_key) != (long)arg) {
+            return;
+        }
+    }
+    __atomic_fetch_add(&g_local_ok, 1, __ATOMIC_RELAXED);
+}
+
+static void test_16() {
+    g_key = co_key_new(drop_request);
+
+    struct co *thd1 = co_start("handler-1", handler, (void *)1);
+    struct co *thd2 = co_start("handler-2", handler, (void *)2);
+    co_wait(thd1);
+    co_wait(thd2);
+
+    printf("%d %d %s", g_local_ok, g_dtor_runs, co_local_get(g_key) ? "set" : "NULL");
+    co_key_free(g_key);
+}
+
+// -----------------------------------------------
+
+static void file_io(void *arg) {
+    char path[] = "/tmp/libco-test-XXXXXX";
+    char buf[16] = { 0 };
+    int fd = mkstemp(path);
+    unlink(path);
+
+    // epoll refuses regular files, they must still work
+    ssize_t w = co_write(fd, "libco", 5);
+    lseek(fd, 0, SEEK_SET);
+    ssize_t r = co_read(fd, buf, sizeof(buf) - 1);
+    co_close(fd);
+    printf("%zd %zd %s", w, r, buf);
+}
+
+static void test_17() {
+    struct co *thd = co_start("file-io", file_io, NULL);
+    co_wait(thd);
+}
+
+// -----------------------------------------------
+
+static int g_listen_fd;
+static long g_connect_ms;
+static int g_connect_state;
+
+static long ms_since(struct timespec *start) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) * 1000 + (now.tv_nsec - start->tv_nsec) / 1000000;
+}
+
+static void slow_connector(void *arg) {
+    struct timespec start;
+    struct tcp_info info;
+    socklen_t len = sizeof(info);
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    // the SYN is dropped until the backlog drains, then retried after ~1s
+    int ret = co_connect(fd, (struct sockaddr *)arg, sizeof(struct sockaddr_in));
+    g_connect_ms = ms_since(&start);
+    getsockopt(fd, IPPROTO_TCP, TCP_INFO, &info, &len);
+    g_connect_state = ret == 0 ? info.tcpi_state : -1;
+    co_close(fd);
+}
+
+static void drainer(void *arg) {
+    co_sleep(100 * 1000000ULL);
+    int fd = co_accept(g_listen_fd, NULL, NULL);
+    co_close(fd);
+}
+
+static void test_18() {
+    struct sockaddr_in addr = { .sin_family = AF_INET };
+    socklen_t len = sizeof(addr);
+
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    g_listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+    bind(g_listen_fd, (struct sockaddr *)&addr, sizeof(addr));
+    getsockname(g_listen_fd, (struct sockaddr *)&addr, &len);
+    listen(g_listen_fd, 0);
+
+    // fills the backlog of 0 (one queued connection)
+    int filler = socket(AF_INET, SOCK_STREAM, 0);
+    connect(filler, (struct sockaddr *)&addr, sizeof(addr));
+
+    struct co *thd1 = co_start("slow-connect", slow_connector, &addr);
+    struct co *thd2 = co_start("drainer", drainer, NULL);
+    co_wait(thd1);
+    co_wait(thd2);
+
+    printf("%s %s", g_connect_state == TCP_ESTABLISHED ? "established" : "not established",
+           g_connect_ms >= 500 ? "after retry" : "too early");
+    close(filler);
+    co_close(g_listen_fd);
+}
+
+static int g_ticks;
+static int g_tick_cancel;
+
+// re-arms itself every 1ms, then cancels and frees itself
+static void ticker(void *arg) {
+    struct co_timer **t = arg;
+
+    if (++g_ticks < 5) {
+        co_timer_arm(*t, 1000000ULL);
+        return;
+    }
+    g_tick_cancel = co_timer_cancel(*t);
+    co_timer_free(*t);
+    __atomic_store_n(t, NULL, __ATOMIC_RELEASE);
+}
+
+static void test_19() {
+    static struct co_timer *t;
+
+    t = co_timer_new(ticker, &t);
+    co_timer_arm(t, 1000000ULL);
+    while (__atomic_load_n(&t, __ATOMIC_ACQUIRE)) {
+        co_sleep(1000000ULL);
+    }
+
+    printf("%d %d freed", g_ticks, g_tick_cancel);
+}
+
+// a plain pthread, libco never hears of it before the send
+static void *late_sender(void *arg) {
+    struct timespec ts = { 0, 50 * 1000000L };
+    nanosleep(&ts, NULL);
+    co_chan_send((struct co_chan *)arg, "late");
+    return NULL;
+}
+
+static void test_20() {
+    struct co_chan *ch = co_chan_new(0);
+    pthread_t tid;
+    void *data;
+
+    // every co parked and no wake source libco knows of, yet no deadlock
+    pthread_create(&tid, NULL, late_sender, ch);
+    co_chan_recv(ch, &data);
+    pthread_join(tid, NULL);
+    co_chan_free(ch);
+
+    printf("%s", (char *)data);
+}
+
+// -----------------------------------------------
+
+static void stuck(void *arg) {
+    void *data;
+    // nobody ever sends
+    co_chan_recv((struct co_chan *)arg, &data);
+}
+
+// run in a fresh process by test_9()
+static void deadlock() {
+    co_set_deadlock_check(1);
+    struct co_chan *ch = co_chan_new(0);
+    struct co *thd = co_start("stuck", stuck, ch);
+    co_wait(thd);
+}
+
+static void test_9() {
+    int fds[2];
+    char report[256] = { 0 };
+    int status;
+
+    assert(pipe(fds) == 0);
+
+    pid_t pid = fork();
+    if (pid == 0) {
+        dup2(fds[1], 2);
+        execl("/proc/self/exe", "main", "deadlock", NULL);
+        _exit(1);
+    }
+
+    close(fds[1]);
+    ssize_t n = read(fds[0], report, sizeof(report) - 1);
+    close(fds[0]);
+    waitpid(pid, &status, 0);
+
+    char *nl = n > 0 ? strchr(report, '\n') : NULL;
+    if (nl) {
+        *nl = '\0';
+    }
+    printf("%s: %s", WIFSIGNALED(status) && WTERMSIG(status) == SIGABRT ? "aborted" : "exited", report);
+}
+
+int main(int argc, char *argv[]) {
+    if (argc == 2 && strcmp(argv[1], "deadlock") == 0) {
+        deadlock();
+        return 0;
+    }
+
     setbuf(stdout, NULL);
 
     printf("Test #1. Expect: (X|Y){0, 1, 2, ..., 199}\n");
@@ -126,6 +960,60 @@ int main() {
     printf("\n\nTest #2. Expect: (libco-){200, 201, 202, ..., 399}\n");
     test_2();
 
+    printf("\n\nTest #3. Expect: 300\n");
+    test_3();
+
+    printf("\n\nTest #4. Expect: 4 threads: 32000\n");
+    test_4();
+
+    printf("\n\nTest #5. Expect: 200/9900  200/9900  200/9900\n");
+    test_5();
+
+    printf("\n\nTest #6. Expect: 800\n");
+    test_6();
+
+    printf("\n\nTest #7. Expect: 50/100\n");
+    test_7();
+
+    printf("\n\nTest #8. Expect: -1 0 abc 80\n");
+    test_8();
+
+    printf("\n\nTest #9. Expect: aborted: libco: all co are asleep - deadlock!\n");
+    test_9();
+
+    printf("\n\nTest #10. Expect: deep>=8KB shallow<4KB 2\n");
+    test_10();
+
+    printf("\n\nTest #11. Expect: HNL low not starved\n");
+    test_11();
+
+    printf("\n\nTest #12. Expect: 5 30 55\n");
+    test_12();
+
+    printf("\n\nTest #13. Expect: 5000050000 10000100000\n");
+    test_13();
+
+    printf("\n\nTest #14. Expect: 8 overlapped 11\n");
+    test_14();
+
+    printf("\n\nTest #15. Expect: quick 3 prompt unlocked\n");
+    test_15();
+
+    printf("\n\nTest #16. Expect: 2 2 NULL\n");
+    test_16();
+
+    printf("\n\nTest #17. Expect: 5 5 libco\n");
+    test_17();
+
+    printf("\n\nTest #18. Expect: established after retry\n");
+    test_18();
+
+    printf("\n\nTest #19. Expect: 5 -1 freed\n");
+    test_19();
+
+    printf("\n\nTest #20. Expect: late\n");
+    test_20();
+
     printf("\n\n");
 
     return 0;